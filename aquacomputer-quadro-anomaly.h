@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Anomaly detection on the readings of the Aquacomputer Quadro, shared by the driver and
+ * its KUnit tests: an exponentially weighted mean and variance with weight
+ * 1 / 2^QUADRO_EWMA_SHIFT per report, the mean kept with QUADRO_EWMA_FRAC fractional bits.
+ */
+
+#ifndef _AQUACOMPUTER_QUADRO_ANOMALY_H
+#define _AQUACOMPUTER_QUADRO_ANOMALY_H
+
+#include <linux/minmax.h>
+#include <linux/types.h>
+
+#define QUADRO_EWMA_SHIFT		4
+#define QUADRO_EWMA_FRAC		8
+#define QUADRO_EWMA_WARMUP		(2 << QUADRO_EWMA_SHIFT) /* Reports before alarming */
+
+/* Keep steady channels from alarming on noise */
+#define QUADRO_ANOMALY_TEMP_MIN_STD	500 /* In millidegrees */
+#define QUADRO_ANOMALY_FLOW_MIN_STD	5 /* In l/h */
+
+struct quadro_ewma {
+	s64 mean; /* With QUADRO_EWMA_FRAC fractional bits */
+	u64 var;
+	unsigned int samples; /* Up to QUADRO_EWMA_WARMUP */
+	u64 anomalies;
+	bool alarm;
+};
+
+/*
+ * Returns whether value deviates from the mean by more than z standard deviations, taken
+ * as at least min_std, and with drops_only only downwards. 0 for z disables the check.
+ * Other values are added to the running statistics, anomalous ones are left out, so a
+ * lasting change stays anomalous until the value is back near the mean from before it.
+ */
+static inline bool quadro_ewma_add(struct quadro_ewma *ewma, s64 value, u64 min_std,
+				   unsigned int z, bool drops_only)
+{
+	s64 diff;
+	u64 var;
+
+	if (!ewma->samples) {
+		ewma->mean = value << QUADRO_EWMA_FRAC;
+		ewma->var = 0;
+		ewma->samples = 1;
+		return false;
+	}
+
+	diff = value - (ewma->mean >> QUADRO_EWMA_FRAC);
+
+	/* Compares squares to avoid a square root, diff^2 > z^2 * var */
+	if (z && ewma->samples >= QUADRO_EWMA_WARMUP && (!drops_only || diff < 0)) {
+		var = max(ewma->var, min_std * min_std);
+		if ((u64)(diff * diff) > (u64)z * z * var)
+			return true;
+	}
+
+	ewma->mean += ((value << QUADRO_EWMA_FRAC) - ewma->mean) >> QUADRO_EWMA_SHIFT;
+	ewma->var += ((s64)(diff * diff) - (s64)ewma->var) >> QUADRO_EWMA_SHIFT;
+
+	if (ewma->samples < QUADRO_EWMA_WARMUP)
+		ewma->samples++;
+
+	return false;
+}
+
+#endif /* _AQUACOMPUTER_QUADRO_ANOMALY_H */
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Decoder for the status report of the Aquacomputer Quadro, shared by the driver and
+ * userspace tools. It only has pure functions over the report bytes and no dependencies
+ * beyond fixed width integers and errno codes, so the same code can be built anywhere.
+ */
+
+#ifndef _AQUACOMPUTER_QUADRO_DECODER_H
+#define _AQUACOMPUTER_QUADRO_DECODER_H
+
+#ifdef __KERNEL__
+#include <linux/build_bug.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#else
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define QUADRO_STATUS_REPORT_ID		0x01
+
+/* Register offsets for the Quadro */
+
+#define QUADRO_SERIAL_FIRST_PART	3
+#define QUADRO_SERIAL_SECOND_PART	5
+#define QUADRO_FIRMWARE_VERSION		13
+#define QUADRO_POWER_CYCLES		24
+
+#define QUADRO_TEMP1			52
+#define QUADRO_TEMP2			54
+#define QUADRO_TEMP3			56
+#define QUADRO_TEMP4			58
+
+#define QUADRO_FLOW_SPEED		110
+#define QUADRO_FAN1_DUTY		112 /* In centipercent */
+#define QUADRO_FAN2_DUTY		125
+#define QUADRO_FAN3_DUTY		138
+#define QUADRO_FAN4_DUTY		151
+#define QUADRO_FAN1_SPEED		120
+#define QUADRO_FAN2_SPEED		133
+#define QUADRO_FAN3_SPEED		146
+#define QUADRO_FAN4_SPEED		159
+
+#define QUADRO_FAN1_POWER		118
+#define QUADRO_FAN2_POWER		131
+#define QUADRO_FAN3_POWER		144
+#define QUADRO_FAN4_POWER		157
+
+#define QUADRO_VOLTAGE			108
+#define QUADRO_FAN1_VOLTAGE		114
+#define QUADRO_FAN2_VOLTAGE		127
+#define QUADRO_FAN3_VOLTAGE		140
+#define QUADRO_FAN4_VOLTAGE		153
+
+#define QUADRO_FAN1_CURRENT		116
+#define QUADRO_FAN2_CURRENT		129
+#define QUADRO_FAN3_CURRENT		142
+#define QUADRO_FAN4_CURRENT		155
+
+/* Fan1-4 each have a block of this many bytes with the same layout */
+#define QUADRO_FAN_STATUS_SIZE		13
+
+/*
+ * Bytes of the status report the decoder reads, up to the end of the last reading. This
+ * is not the length of the report, which at least completes the Fan4 block: the driver
+ * takes that from the device's HID report descriptor and refuses devices whose status
+ * report doesn't cover the readings.
+ */
+#define QUADRO_STATUS_DECODED_SIZE	(QUADRO_FAN4_SPEED + 2)
+
+/* The readings in the order of their offsets, a typo in one overlaps it with its neighbour */
+#define QUADRO_ASSERT_BEFORE(offset, width, next)					\
+	static_assert((offset) + (width) <= (next), #offset " overlaps " #next)
+
+static_assert(QUADRO_SERIAL_FIRST_PART >= 1, "QUADRO_SERIAL_FIRST_PART overlaps the report ID");
+QUADRO_ASSERT_BEFORE(QUADRO_SERIAL_FIRST_PART, 2, QUADRO_SERIAL_SECOND_PART);
+QUADRO_ASSERT_BEFORE(QUADRO_SERIAL_SECOND_PART, 2, QUADRO_FIRMWARE_VERSION);
+QUADRO_ASSERT_BEFORE(QUADRO_FIRMWARE_VERSION, 2, QUADRO_POWER_CYCLES);
+QUADRO_ASSERT_BEFORE(QUADRO_POWER_CYCLES, 4, QUADRO_TEMP1);
+QUADRO_ASSERT_BEFORE(QUADRO_TEMP1, 2, QUADRO_TEMP2);
+QUADRO_ASSERT_BEFORE(QUADRO_TEMP2, 2, QUADRO_TEMP3);
+QUADRO_ASSERT_BEFORE(QUADRO_TEMP3, 2, QUADRO_TEMP4);
+QUADRO_ASSERT_BEFORE(QUADRO_TEMP4, 2, QUADRO_VOLTAGE);
+QUADRO_ASSERT_BEFORE(QUADRO_VOLTAGE, 2, QUADRO_FLOW_SPEED);
+QUADRO_ASSERT_BEFORE(QUADRO_FLOW_SPEED, 2, QUADRO_FAN1_DUTY);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN1_DUTY, 2, QUADRO_FAN1_VOLTAGE);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN1_VOLTAGE, 2, QUADRO_FAN1_CURRENT);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN1_CURRENT, 2, QUADRO_FAN1_POWER);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN1_POWER, 2, QUADRO_FAN1_SPEED);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN1_SPEED, 2, QUADRO_FAN1_DUTY + QUADRO_FAN_STATUS_SIZE);
+QUADRO_ASSERT_BEFORE(QUADRO_FAN4_SPEED, 2, QUADRO_STATUS_DECODED_SIZE);
+
+/* Fan2-4 repeat the layout of Fan1, one block further each */
+#define QUADRO_ASSERT_FAN(n, reading)							\
+	static_assert(QUADRO_FAN##n##_##reading ==					\
+		      QUADRO_FAN1_##reading + ((n) - 1) * QUADRO_FAN_STATUS_SIZE,	\
+		      "QUADRO_FAN" #n "_" #reading " is outside of the Fan" #n " block")
+
+#define QUADRO_ASSERT_FAN_BLOCK(n)	\
+	QUADRO_ASSERT_FAN(n, DUTY);	\
+	QUADRO_ASSERT_FAN(n, VOLTAGE);	\
+	QUADRO_ASSERT_FAN(n, CURRENT);	\
+	QUADRO_ASSERT_FAN(n, POWER);	\
+	QUADRO_ASSERT_FAN(n, SPEED)
+
+QUADRO_ASSERT_FAN_BLOCK(2);
+QUADRO_ASSERT_FAN_BLOCK(3);
+QUADRO_ASSERT_FAN_BLOCK(4);
+
+/* Decoded readings, in the units of hwmon */
+struct quadro_status {
+	uint32_t serial_number[2];
+	uint16_t firmware_version;
+	uint32_t power_cycles; /* How many times the device was powered on */
+	int32_t temp[4]; /* Millidegrees */
+	uint16_t speed[5]; /* Flow in l/h, fans in RPM */
+	uint32_t power[4]; /* Microwatts */
+	uint32_t voltage[5]; /* Millivolts */
+	uint16_t curr[4]; /* Milliamperes */
+	uint16_t duty[4]; /* Actual duty in centipercent */
+};
+
+static inline uint16_t quadro_get_be16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t quadro_get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Checks that size bytes at data are a status report that can be decoded */
+static inline int quadro_check_status(const uint8_t *data, size_t size)
+{
+	if (size < QUADRO_STATUS_DECODED_SIZE)
+		return -ENODATA;
+
+	if (data[0] != QUADRO_STATUS_REPORT_ID)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* data must hold at least QUADRO_STATUS_DECODED_SIZE bytes, see quadro_parse_status() */
+static inline void quadro_decode_status(struct quadro_status *status, const uint8_t *data)
+{
+	/* Info provided with every report */
+
+	status->serial_number[0] = quadro_get_be16(data + QUADRO_SERIAL_FIRST_PART);
+	status->serial_number[1] = quadro_get_be16(data + QUADRO_SERIAL_SECOND_PART);
+
+	status->firmware_version = quadro_get_be16(data + QUADRO_FIRMWARE_VERSION);
+	status->power_cycles = quadro_get_be32(data + QUADRO_POWER_CYCLES);
+
+	/* Sensor readings */
+
+	status->temp[0] = quadro_get_be16(data + QUADRO_TEMP1) * 10;
+	status->temp[1] = quadro_get_be16(data + QUADRO_TEMP2) * 10;
+	status->temp[2] = quadro_get_be16(data + QUADRO_TEMP3) * 10;
+	status->temp[3] = quadro_get_be16(data + QUADRO_TEMP4) * 10;
+
+	status->speed[0] = quadro_get_be16(data + QUADRO_FLOW_SPEED) / 10;
+	status->speed[1] = quadro_get_be16(data + QUADRO_FAN1_SPEED);
+	status->speed[2] = quadro_get_be16(data + QUADRO_FAN2_SPEED);
+	status->speed[3] = quadro_get_be16(data + QUADRO_FAN3_SPEED);
+	status->speed[4] = quadro_get_be16(data + QUADRO_FAN4_SPEED);
+
+	status->power[0] = quadro_get_be16(data + QUADRO_FAN1_POWER) * 10000;
+	status->power[1] = quadro_get_be16(data + QUADRO_FAN2_POWER) * 10000;
+	status->power[2] = quadro_get_be16(data + QUADRO_FAN3_POWER) * 10000;
+	status->power[3] = quadro_get_be16(data + QUADRO_FAN4_POWER) * 10000;
+
+	status->voltage[0] = quadro_get_be16(data + QUADRO_VOLTAGE) * 10;
+	status->voltage[1] = quadro_get_be16(data + QUADRO_FAN1_VOLTAGE) * 10;
+	status->voltage[2] = quadro_get_be16(data + QUADRO_FAN2_VOLTAGE) * 10;
+	status->voltage[3] = quadro_get_be16(data + QUADRO_FAN3_VOLTAGE) * 10;
+	status->voltage[4] = quadro_get_be16(data + QUADRO_FAN4_VOLTAGE) * 10;
+
+	status->curr[0] = quadro_get_be16(data + QUADRO_FAN1_CURRENT);
+	status->curr[1] = quadro_get_be16(data + QUADRO_FAN2_CURRENT);
+	status->curr[2] = quadro_get_be16(data + QUADRO_FAN3_CURRENT);
+	status->curr[3] = quadro_get_be16(data + QUADRO_FAN4_CURRENT);
+
+	status->duty[0] = quadro_get_be16(data + QUADRO_FAN1_DUTY);
+	status->duty[1] = quadro_get_be16(data + QUADRO_FAN2_DUTY);
+	status->duty[2] = quadro_get_be16(data + QUADRO_FAN3_DUTY);
+	status->duty[3] = quadro_get_be16(data + QUADRO_FAN4_DUTY);
+}
+
+/* Decodes a report of any size and ID, as received from the device */
+static inline int quadro_parse_status(struct quadro_status *status, const uint8_t *data,
+				      size_t size)
+{
+	int ret;
+
+	ret = quadro_check_status(data, size);
+	if (ret)
+		return ret;
+
+	quadro_decode_status(status, data);
+
+	return 0;
+}
+
+#endif /* _AQUACOMPUTER_QUADRO_DECODER_H */
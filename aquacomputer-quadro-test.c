@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests for the status report decoder and the anomaly detection of the Aquacomputer
+ * Quadro. Built as its own module when the kernel has CONFIG_KUNIT, the results are reported
+ * when it is loaded.
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/string.h>
+
+#include "aquacomputer-quadro-anomaly.h"
+#include "aquacomputer-quadro-decoder.h"
+
+static void quadro_test_put_be16(u8 *report, int offset, u16 val)
+{
+	report[offset] = val >> 8;
+	report[offset + 1] = val;
+}
+
+/* A report as the device sends it, with different raw values for all readings */
+static void quadro_test_report(u8 *report)
+{
+	static const int fan_offsets[4] = {
+		QUADRO_FAN1_DUTY, QUADRO_FAN2_DUTY, QUADRO_FAN3_DUTY, QUADRO_FAN4_DUTY
+	};
+	int i, fan;
+
+	memset(report, 0, QUADRO_STATUS_DECODED_SIZE);
+	report[0] = QUADRO_STATUS_REPORT_ID;
+
+	quadro_test_put_be16(report, QUADRO_SERIAL_FIRST_PART, 12345);
+	quadro_test_put_be16(report, QUADRO_SERIAL_SECOND_PART, 6789);
+	quadro_test_put_be16(report, QUADRO_FIRMWARE_VERSION, 1025);
+	report[QUADRO_POWER_CYCLES] = 0x01;
+	report[QUADRO_POWER_CYCLES + 1] = 0x02;
+	report[QUADRO_POWER_CYCLES + 2] = 0x03;
+	report[QUADRO_POWER_CYCLES + 3] = 0x04;
+
+	quadro_test_put_be16(report, QUADRO_TEMP1, 2512);
+	quadro_test_put_be16(report, QUADRO_TEMP2, 3001);
+	quadro_test_put_be16(report, QUADRO_TEMP3, 0);
+	quadro_test_put_be16(report, QUADRO_TEMP4, 0xffff);
+
+	quadro_test_put_be16(report, QUADRO_VOLTAGE, 1210);
+	quadro_test_put_be16(report, QUADRO_FLOW_SPEED, 1234);
+
+	/* Fan blocks share a layout, the values tell the fans apart */
+	for (i = 0; i < 4; i++) {
+		fan = fan_offsets[i] - QUADRO_FAN1_DUTY;
+
+		quadro_test_put_be16(report, QUADRO_FAN1_DUTY + fan, 2500 * (i + 1));
+		quadro_test_put_be16(report, QUADRO_FAN1_VOLTAGE + fan, 1200 + i);
+		quadro_test_put_be16(report, QUADRO_FAN1_CURRENT + fan, 10 + i);
+		quadro_test_put_be16(report, QUADRO_FAN1_POWER + fan, 140 + i);
+		quadro_test_put_be16(report, QUADRO_FAN1_SPEED + fan, 1000 + i);
+	}
+}
+
+static void quadro_decode_status_test(struct kunit *test)
+{
+	u8 report[QUADRO_STATUS_DECODED_SIZE];
+	struct quadro_status status;
+	int i;
+
+	quadro_test_report(report);
+	quadro_decode_status(&status, report);
+
+	KUNIT_EXPECT_EQ(test, status.serial_number[0], 12345);
+	KUNIT_EXPECT_EQ(test, status.serial_number[1], 6789);
+	KUNIT_EXPECT_EQ(test, status.firmware_version, 1025);
+	KUNIT_EXPECT_EQ(test, status.power_cycles, 0x01020304);
+
+	/* Centidegrees to millidegrees */
+	KUNIT_EXPECT_EQ(test, status.temp[0], 25120);
+	KUNIT_EXPECT_EQ(test, status.temp[1], 30010);
+	KUNIT_EXPECT_EQ(test, status.temp[2], 0);
+	KUNIT_EXPECT_EQ(test, status.temp[3], 655350);
+
+	/* Flow in dl/h to l/h, VCC in centivolts to millivolts */
+	KUNIT_EXPECT_EQ(test, status.speed[0], 123);
+	KUNIT_EXPECT_EQ(test, status.voltage[0], 12100);
+
+	for (i = 0; i < 4; i++) {
+		KUNIT_EXPECT_EQ(test, status.duty[i], 2500 * (i + 1));
+		KUNIT_EXPECT_EQ(test, status.voltage[i + 1], (1200 + i) * 10);
+		KUNIT_EXPECT_EQ(test, status.curr[i], 10 + i);
+		/* Centiwatts to microwatts */
+		KUNIT_EXPECT_EQ(test, status.power[i], (140 + i) * 10000);
+		KUNIT_EXPECT_EQ(test, status.speed[i + 1], 1000 + i);
+	}
+}
+
+static void quadro_check_status_test(struct kunit *test)
+{
+	u8 report[QUADRO_STATUS_DECODED_SIZE];
+
+	quadro_test_report(report);
+
+	KUNIT_EXPECT_EQ(test, quadro_check_status(report, sizeof(report)), 0);
+	KUNIT_EXPECT_EQ(test, quadro_check_status(report, sizeof(report) - 1), -ENODATA);
+	KUNIT_EXPECT_EQ(test, quadro_check_status(report, 0), -ENODATA);
+
+	report[0] = QUADRO_STATUS_REPORT_ID + 1;
+	KUNIT_EXPECT_EQ(test, quadro_check_status(report, sizeof(report)), -EINVAL);
+}
+
+/* Rejected reports must leave the previous readings alone */
+static void quadro_parse_status_test(struct kunit *test)
+{
+	u8 report[QUADRO_STATUS_DECODED_SIZE];
+	struct quadro_status status;
+
+	quadro_test_report(report);
+	memset(&status, 0xaa, sizeof(status));
+
+	KUNIT_EXPECT_EQ(test, quadro_parse_status(&status, report, sizeof(report) - 1), -ENODATA);
+	KUNIT_EXPECT_PTR_EQ(test, memchr_inv(&status, 0xaa, sizeof(status)), NULL);
+
+	KUNIT_EXPECT_EQ(test, quadro_parse_status(&status, report, sizeof(report)), 0);
+	KUNIT_EXPECT_EQ(test, status.speed[4], 1003);
+}
+
+static struct kunit_case quadro_decoder_test_cases[] = {
+	KUNIT_CASE(quadro_decode_status_test),
+	KUNIT_CASE(quadro_check_status_test),
+	KUNIT_CASE(quadro_parse_status_test),
+	{}
+};
+
+static struct kunit_suite quadro_decoder_test_suite = {
+	.name = "aquacomputer-quadro-decoder",
+	.test_cases = quadro_decoder_test_cases,
+};
+
+/* The driver's default for anomaly_z */
+#define QUADRO_TEST_Z		4
+
+/* Feeds reports around base, alternating by noise, and expects none to be anomalous */
+static void quadro_test_ewma_settle(struct kunit *test, struct quadro_ewma *ewma, s64 base,
+				    s64 noise, u64 min_std, bool drops_only)
+{
+	int i;
+
+	for (i = 0; i < 2 * QUADRO_EWMA_WARMUP; i++)
+		KUNIT_EXPECT_FALSE(test, quadro_ewma_add(ewma, base + (i & 1 ? noise : -noise),
+							 min_std, QUADRO_TEST_Z, drops_only));
+}
+
+/* A lasting drop of the flow from 100 to 40 l/h alarms until the flow is back */
+static void quadro_ewma_flow_step_test(struct kunit *test)
+{
+	struct quadro_ewma ewma = {};
+	int i;
+
+	quadro_test_ewma_settle(test, &ewma, 100, 1, QUADRO_ANOMALY_FLOW_MIN_STD, true);
+
+	for (i = 0; i < 4 * QUADRO_EWMA_WARMUP; i++)
+		KUNIT_EXPECT_TRUE(test, quadro_ewma_add(&ewma, 40, QUADRO_ANOMALY_FLOW_MIN_STD,
+							QUADRO_TEST_Z, true));
+
+	KUNIT_EXPECT_FALSE(test, quadro_ewma_add(&ewma, 100, QUADRO_ANOMALY_FLOW_MIN_STD,
+						 QUADRO_TEST_Z, true));
+
+	/* Only drops count for the flow */
+	KUNIT_EXPECT_FALSE(test, quadro_ewma_add(&ewma, 160, QUADRO_ANOMALY_FLOW_MIN_STD,
+						 QUADRO_TEST_Z, true));
+}
+
+/* A lasting rise of a temperature from 30 to 45 degrees alarms until it is back */
+static void quadro_ewma_temp_step_test(struct kunit *test)
+{
+	struct quadro_ewma ewma = {};
+	int i;
+
+	quadro_test_ewma_settle(test, &ewma, 30000, 100, QUADRO_ANOMALY_TEMP_MIN_STD, false);
+
+	for (i = 0; i < 4 * QUADRO_EWMA_WARMUP; i++)
+		KUNIT_EXPECT_TRUE(test, quadro_ewma_add(&ewma, 45000, QUADRO_ANOMALY_TEMP_MIN_STD,
+							QUADRO_TEST_Z, false));
+
+	/* Still off by more than z times the minimum deviation */
+	KUNIT_EXPECT_TRUE(test, quadro_ewma_add(&ewma, 32500, QUADRO_ANOMALY_TEMP_MIN_STD,
+						QUADRO_TEST_Z, false));
+
+	KUNIT_EXPECT_FALSE(test, quadro_ewma_add(&ewma, 30200, QUADRO_ANOMALY_TEMP_MIN_STD,
+						 QUADRO_TEST_Z, false));
+
+	/* A drop is an excursion as well */
+	KUNIT_EXPECT_TRUE(test, quadro_ewma_add(&ewma, 20000, QUADRO_ANOMALY_TEMP_MIN_STD,
+						QUADRO_TEST_Z, false));
+}
+
+/* Nothing alarms during the warmup or with z of 0 */
+static void quadro_ewma_quiet_test(struct kunit *test)
+{
+	struct quadro_ewma ewma = {};
+	int i;
+
+	for (i = 0; i < QUADRO_EWMA_WARMUP - 1; i++)
+		KUNIT_EXPECT_FALSE(test, quadro_ewma_add(&ewma, i & 1 ? 30000 : 60000,
+							 QUADRO_ANOMALY_TEMP_MIN_STD,
+							 QUADRO_TEST_Z, false));
+
+	quadro_test_ewma_settle(test, &ewma, 30000, 100, QUADRO_ANOMALY_TEMP_MIN_STD, false);
+	KUNIT_EXPECT_FALSE(test, quadro_ewma_add(&ewma, 45000, QUADRO_ANOMALY_TEMP_MIN_STD, 0,
+						 false));
+}
+
+static struct kunit_case quadro_anomaly_test_cases[] = {
+	KUNIT_CASE(quadro_ewma_flow_step_test),
+	KUNIT_CASE(quadro_ewma_temp_step_test),
+	KUNIT_CASE(quadro_ewma_quiet_test),
+	{}
+};
+
+static struct kunit_suite quadro_anomaly_test_suite = {
+	.name = "aquacomputer-quadro-anomaly",
+	.test_cases = quadro_anomaly_test_cases,
+};
+
+kunit_test_suites(&quadro_decoder_test_suite, &quadro_anomaly_test_suite);
+
+MODULE_DESCRIPTION("KUnit tests for the Aquacomputer Quadro decoder and anomaly detection");
+MODULE_LICENSE("GPL");
@@ -6,55 +6,211 @@
  * (temperatures, fan speeds, voltage, current and power). It responds to
  * Get_Report requests, but returns a dummy value of no use.
  *
+ * Fan control settings live in a feature report (ID 0x03) that is read, modified and
+ * written back as a whole, followed by a short secondary report that makes the device
+ * apply them. The control loops themselves run in the firmware.
+ *
+ * Userspace can write the same report through hidraw at any time. The driver keeps a
+ * shadow of the report and tracks which bytes it changed itself, so that on every write
+ * it merges just those into the report freshly read from the device instead of
+ * overwriting changes made by others.
+ *
+ * Besides hwmon, each device gets a character device /dev/quadroN whose ioctls return
+ * decoded samples from a short history, see aquacomputer-quadro.h, and an IIO device
+ * that pushes every sample into a kfifo buffer for continuous capture.
+ *
+ * Reports arrive in URB completion (atomic) context. quadro_raw_event() only copies
+ * and timestamps them; decoding and everything built on top of it runs from a work item.
+ *
  * Copyright 2021 Leonard Anderweit <leonard.anderweit@gmail.com>
  */
 
 #include <asm/unaligned.h>
+#include <linux/crc16.h>
 #include <linux/debugfs.h>
 #include <linux/hid.h>
 #include <linux/hwmon.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/idr.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/kfifo_buf.h>
 #include <linux/jiffies.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/relay.h>
 #include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/thermal.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "aquacomputer-quadro-anomaly.h"
+#include "aquacomputer-quadro-decoder.h"
+#include "aquacomputer-quadro.h"
 
 #define DRIVER_NAME			"aquacomputer-quadro"
 
-#define QUADRO_STATUS_REPORT_ID	0x01
 #define QUADRO_STATUS_UPDATE_INTERVAL	(2 * HZ) /* In seconds */
 
-/* Register offsets for the Quadro */
-
-#define QUADRO_SERIAL_FIRST_PART	3
-#define QUADRO_SERIAL_SECOND_PART	5
-#define QUADRO_FIRMWARE_VERSION	13
-#define QUADRO_POWER_CYCLES		24
-
-#define QUADRO_TEMP1			52
-#define QUADRO_TEMP2			54
-#define QUADRO_TEMP3			56
-#define QUADRO_TEMP4			58
-
-#define QUADRO_FLOW_SPEED		110
-#define QUADRO_FAN1_SPEED		120
-#define QUADRO_FAN2_SPEED		133
-#define QUADRO_FAN3_SPEED		146
-#define QUADRO_FAN4_SPEED		159
-		
-#define QUADRO_FAN1_POWER		118
-#define QUADRO_FAN2_POWER		131
-#define QUADRO_FAN3_POWER		144
-#define QUADRO_FAN4_POWER		157
-
-#define QUADRO_VOLTAGE			108
-#define QUADRO_FAN1_VOLTAGE		114
-#define QUADRO_FAN2_VOLTAGE		127
-#define QUADRO_FAN3_VOLTAGE		140
-#define QUADRO_FAN4_VOLTAGE		153
-
-#define QUADRO_FAN1_CURRENT		116
-#define QUADRO_FAN2_CURRENT		129
-#define QUADRO_FAN3_CURRENT		142
-#define QUADRO_FAN4_CURRENT		155
+/* Weight 1 / 2^QUADRO_PERIOD_SHIFT of each interval in the average report period */
+#define QUADRO_PERIOD_SHIFT		3
+
+/*
+ * Software sensors are temperatures supplied by the host which the device can use as
+ * sources for its fan control. They are sent as an output report holding all of them
+ * in centidegrees, QUADRO_SW_SENSOR_UNSET marks a sensor without a value.
+ */
+#define QUADRO_SW_SENSOR_REPORT_ID	0x04
+#define QUADRO_NUM_SW_SENSORS		16
+#define QUADRO_SW_SENSOR_REPORT_SIZE	(1 + 2 * QUADRO_NUM_SW_SENSORS)
+#define QUADRO_SW_SENSOR_UNSET		0x7fff
+
+/* Control report and offsets within it */
+#define QUADRO_CTRL_REPORT_ID		0x03
+#define QUADRO_CTRL_REPORT_SIZE		0x3c1
+#define QUADRO_CTRL_CHECKSUM_START	0x01
+#define QUADRO_CTRL_CHECKSUM_LENGTH	(QUADRO_CTRL_REPORT_SIZE - QUADRO_CTRL_CHECKSUM_START - 2)
+#define QUADRO_CTRL_CHECKSUM		(QUADRO_CTRL_REPORT_SIZE - 2)
+
+#define QUADRO_CTRL_CACHE_TIME		HZ /* How long reads are served from the shadow */
+
+#define QUADRO_SECONDARY_CTRL_REPORT_ID	0x02
+#define QUADRO_SECONDARY_CTRL_REPORT_SIZE	0x0b
+
+#define QUADRO_CTRL_FLOW_PULSES		0x06
+#define QUADRO_CTRL_TEMP_OFFSETS	0x0a /* Calibration of Temp1-4 in centidegrees */
+
+#define QUADRO_NUM_FANS			4
+
+/* Start of the control block of each fan */
+static const u16 quadro_ctrl_fan_offsets[QUADRO_NUM_FANS] = { 0x36, 0x8b, 0xe0, 0x135 };
+
+/* Offsets within a fan control block */
+#define QUADRO_FAN_CTRL_MODE		0x00
+#define QUADRO_FAN_CTRL_PWM		0x01 /* In centipercent */
+#define QUADRO_FAN_CTRL_TEMP_SELECT	0x03
+#define QUADRO_FAN_CTRL_CURVE_TEMP	0x15 /* QUADRO_CURVE_POINTS temperatures in centidegrees */
+#define QUADRO_FAN_CTRL_CURVE_PWM	0x35 /* QUADRO_CURVE_POINTS duties in centipercent */
+
+#define QUADRO_CURVE_POINTS		16
+
+/* Fan control modes, exposed as pwmX_enable = mode + 1 */
+#define QUADRO_FAN_MODE_MANUAL		0
+#define QUADRO_FAN_MODE_PID		1
+#define QUADRO_FAN_MODE_CURVE		2
+#define QUADRO_FAN_MODE_FOLLOW		3
+
+/* Temperature sources: Temp1-4 followed by the software sensors */
+#define QUADRO_NUM_TEMP_SOURCES		(4 + QUADRO_NUM_SW_SENSORS)
+
+/* The report the official software sends after the control report to apply it */
+static const u8 quadro_secondary_ctrl_report[QUADRO_SECONDARY_CTRL_REPORT_SIZE] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x34, 0xc6, 0x00
+};
+
+/* Decoded samples kept for the character device */
+#define QUADRO_HISTORY_LEN		256
+
+/* Buckets of the per-fan residency histograms, the last ones are open ended */
+#define QUADRO_RPM_BUCKET_WIDTH		250
+#define QUADRO_RPM_BUCKETS		16
+#define QUADRO_DUTY_BUCKET_WIDTH	1000 /* In centipercent */
+#define QUADRO_DUTY_BUCKETS		10
+
+/* Anomaly detection on Temp1-4 and the flow, see aquacomputer-quadro-anomaly.h */
+#define QUADRO_ANOMALY_CHANNELS		5 /* Temp1-4, flow */
+#define QUADRO_ANOMALY_FLOW		4
+
+/* Notable events kept for post-mortems in debugfs, the oldest are overwritten */
+#define QUADRO_EVENT_LOG_LEN		64
+
+enum quadro_event_type {
+	QUADRO_EVENT_FAN_FAULT,		/* Channel is the fan, value 1 raised, 0 cleared */
+	QUADRO_EVENT_ANOMALY,		/* Channel is Temp1-4 or 4 for the flow, value as above */
+	QUADRO_EVENT_STALE,		/* No report within QUADRO_STATUS_UPDATE_INTERVAL */
+	QUADRO_EVENT_RECOVERED,		/* Reports arrive again */
+	QUADRO_EVENT_FIRMWARE,		/* Value is the new firmware version */
+	QUADRO_EVENT_POWER_CYCLES,	/* Value is the new power cycle count */
+};
+
+static const char *const quadro_event_names[] = {
+	[QUADRO_EVENT_FAN_FAULT] = "fan_fault",
+	[QUADRO_EVENT_ANOMALY] = "anomaly",
+	[QUADRO_EVENT_STALE] = "stale",
+	[QUADRO_EVENT_RECOVERED] = "recovered",
+	[QUADRO_EVENT_FIRMWARE] = "firmware",
+	[QUADRO_EVENT_POWER_CYCLES] = "power_cycles",
+};
+
+/* Trip points of the thermal zones registered for Temp1-4 */
+#define QUADRO_NUM_TRIPS		2
+#define QUADRO_TRIP_HYSTERESIS		1000
+
+static int trip_active = 40000;
+module_param(trip_active, int, 0444);
+MODULE_PARM_DESC(trip_active,
+		 "Initial active trip point of the thermal zones in millidegrees (default 40000)");
+
+static int trip_passive = 50000;
+module_param(trip_passive, int, 0444);
+MODULE_PARM_DESC(trip_passive,
+		 "Initial passive trip point of the thermal zones in millidegrees (default 50000)");
+
+/* Cooling states of the fans, mapped linearly to 0-100% duty */
+#define QUADRO_COOLING_STATES		10
+
+static bool thermal_bind;
+module_param(thermal_bind, bool, 0444);
+MODULE_PARM_DESC(thermal_bind,
+		 "Bind the fans to the active trip point of the device's own thermal zones (default false)");
+
+static unsigned int sw_sensor_interval = 1000;
+module_param(sw_sensor_interval, uint, 0644);
+MODULE_PARM_DESC(sw_sensor_interval,
+		 "Time in ms software sensor writes are coalesced before being sent (default 1000)");
+
+static unsigned int fan_stall_rpm = 100;
+module_param(fan_stall_rpm, uint, 0644);
+MODULE_PARM_DESC(fan_stall_rpm, "Speed below which a driven fan counts as stalled (default 100)");
+
+static unsigned int fan_stall_duty = 20;
+module_param(fan_stall_duty, uint, 0644);
+MODULE_PARM_DESC(fan_stall_duty, "Duty in percent from which a fan counts as driven (default 20)");
+
+static unsigned int fan_stall_current;
+module_param(fan_stall_current, uint, 0644);
+MODULE_PARM_DESC(fan_stall_current,
+		 "Current in mA from which a fan counts as driven, 0 to ignore (default 0)");
+
+static unsigned int fan_stall_reports = 3;
+module_param(fan_stall_reports, uint, 0644);
+MODULE_PARM_DESC(fan_stall_reports,
+		 "Consecutive stalled reports before fanX_fault is raised (default 3)");
+
+static unsigned int anomaly_z = 4;
+module_param(anomaly_z, uint, 0644);
+MODULE_PARM_DESC(anomaly_z,
+		 "Standard deviations from the running mean that raise an anomaly alarm, 0 disables (default 4)");
+
+static bool raw_relay;
+module_param(raw_relay, bool, 0444);
+MODULE_PARM_DESC(raw_relay,
+		 "Stream raw status reports through a relay channel in debugfs (default false)");
+
+static unsigned int raw_relay_subbuf_size = 16384;
+module_param(raw_relay_subbuf_size, uint, 0444);
+MODULE_PARM_DESC(raw_relay_subbuf_size, "Size in bytes of each relay sub-buffer (default 16384)");
+
+static unsigned int raw_relay_subbufs = 8;
+module_param(raw_relay_subbufs, uint, 0444);
+MODULE_PARM_DESC(raw_relay_subbufs, "Number of relay sub-buffers per CPU (default 8)");
 
 /* Labels for provided values */
 
@@ -85,11 +241,17 @@
 #define L_FAN3_CURRENT		"Fan3 current"
 #define L_FAN4_CURRENT		"Fan4 current"
 
+#define L_DERIVED_TEMP1		"Derived temp1"
+#define L_DERIVED_TEMP2		"Derived temp2"
+#define L_DERIVED_POWER		"Derived power"
+
 static const char *const label_temps[] = {
 	L_TEMP1,
 	L_TEMP2,
 	L_TEMP3,
 	L_TEMP4,
+	L_DERIVED_TEMP1,
+	L_DERIVED_TEMP2,
 };
 
 static const char *const label_speeds[] = {
@@ -105,6 +267,7 @@ static const char *const label_power[] = {
 	L_FAN2_POWER,
 	L_FAN3_POWER,
 	L_FAN4_POWER,
+	L_DERIVED_POWER,
 };
 
 static const char *const label_voltages[] = {
@@ -122,50 +285,441 @@ static const char *const label_current[] = {
 	L_FAN4_CURRENT,
 };
 
+/* Sensor types with an input attribute, indexing the per-type notification settings */
+struct quadro_input_type {
+	enum hwmon_sensor_types type;
+	u32 attr;
+	int channels;
+};
+
+static const struct quadro_input_type quadro_input_types[] = {
+	{ hwmon_temp, hwmon_temp_input, 6 },
+	{ hwmon_fan, hwmon_fan_input, 5 },
+	{ hwmon_power, hwmon_power_input, 5 },
+	{ hwmon_in, hwmon_in_input, 5 },
+	{ hwmon_curr, hwmon_curr_input, 4 },
+};
+
+#define QUADRO_NUM_INPUT_TYPES		ARRAY_SIZE(quadro_input_types)
+#define QUADRO_MAX_CHANNELS		6
+
+/*
+ * Derived channels are computed once per report as a fixed point linear combination
+ * of the four physical channels of the same type (Temp1-4 or Fan1-4 power). They
+ * follow the physical channels of their type.
+ */
+struct quadro_derived_channel {
+	enum hwmon_sensor_types type;
+	int channel;
+};
+
+static const struct quadro_derived_channel quadro_derived_channels[] = {
+	{ hwmon_temp, 4 },
+	{ hwmon_temp, 5 },
+	{ hwmon_power, 4 },
+};
+
+#define QUADRO_NUM_DERIVED		ARRAY_SIZE(quadro_derived_channels)
+#define QUADRO_DERIVED_TERMS		4
+#define QUADRO_DERIVED_SCALE		1000 /* Coefficients are in thousandths */
+#define QUADRO_DERIVED_COEFF_MAX	(1000 * QUADRO_DERIVED_SCALE)
+
+struct quadro_event {
+	u64 timestamp; /* ktime_get_ns() */
+	enum quadro_event_type type;
+	int channel;
+	long value;
+};
+
+struct quadro_timing {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct quadro_data;
+
+struct quadro_thermal {
+	struct quadro_data *priv;
+	int channel;
+	struct thermal_zone_device *tz;
+	struct thermal_trip trips[QUADRO_NUM_TRIPS];
+};
+
+struct quadro_cooling {
+	struct quadro_data *priv;
+	int fan;
+	struct thermal_cooling_device *cdev;
+	/* Under ctrl_lock: set while a state above 0 holds the fan, with what it replaced */
+	bool claimed;
+	u8 saved_mode;
+	u16 saved_pwm;
+};
+
+/*
+ * Freed when the device is removed and the last file handle of the character
+ * device is closed, whichever comes last.
+ */
 struct quadro_data {
+	struct kref kref;
 	struct hid_device *hdev;
 	struct device *hwmon_dev;
 	struct dentry *debugfs;
-	s32 temp_input[4];
-	u16 speed_input[5];
-	u32 power_input[4];
-	u16 voltage_input[5];
-	u16 current_input[4];
-	u32 serial_number[2];
-	u16 firmware_version;
-	u32 power_cycles; /* How many times the device was powered on */
+	struct quadro_thermal thermal[4];
+	struct quadro_cooling cooling[QUADRO_NUM_FANS];
+	struct iio_dev *indio_dev;
+	int status_size; /* Of the status report, as declared by the report descriptor */
+
+	/* Raw report handoff from quadro_raw_event(), protected by raw_lock */
+	spinlock_t raw_lock;
+	u8 raw_report[QUADRO_STATUS_DECODED_SIZE];
+	u64 raw_timestamp; /* ktime_get_ns() at arrival */
+	unsigned long raw_jiffies;
+	u64 raw_seq;
+	u64 raw_period; /* Average time between reports in ns, 0 until measured */
+	u64 decoded_seq;
+	u64 coalesced; /* Reports overwritten before the work item ran */
+	struct rchan *relay;
+	u64 relay_dropped; /* Reports that didn't fit into the relay sub-buffers */
+	struct quadro_timing atomic_timing;
+	struct work_struct work;
+
+	/* Decoded values, protected by lock */
+	struct mutex lock;
+	struct quadro_timing deferred_timing;
+	struct quadro_status status;
+	u64 timestamp; /* ktime_get_ns() at arrival of the decoded report */
+	u64 period; /* raw_period at that time */
 	unsigned long updated;
+
+	s32 derived_coeffs[QUADRO_NUM_DERIVED][QUADRO_DERIVED_TERMS];
+	long derived_input[QUADRO_NUM_DERIVED];
+
+	/* Notification policy, 0 disables the respective trigger */
+	unsigned int notify_interval; /* Notify all inputs every Nth report */
+	long notify_delta[QUADRO_NUM_INPUT_TYPES]; /* Notify on change by more than this */
+	unsigned int notify_count;
+	long notified_value[QUADRO_NUM_INPUT_TYPES][QUADRO_MAX_CHANNELS];
+
+	/* Time in ns each fan spent in the speed and duty buckets */
+	u64 rpm_residency[QUADRO_NUM_FANS][QUADRO_RPM_BUCKETS];
+	u64 duty_residency[QUADRO_NUM_FANS][QUADRO_DUTY_BUCKETS];
+
+	unsigned int stall_count[QUADRO_NUM_FANS]; /* Consecutive stalled reports */
+	bool fan_seen[QUADRO_NUM_FANS]; /* Ran at fan_stall_rpm since probe or reboot */
+	bool fan_fault[QUADRO_NUM_FANS];
+
+	struct quadro_ewma ewma[QUADRO_ANOMALY_CHANNELS];
+
+	struct quadro_event events[QUADRO_EVENT_LOG_LEN];
+	u64 event_count;
+	bool stale;
+	struct delayed_work stale_work; /* Fires when reports stop arriving */
+
+	/* Sample history, protected by lock */
+	struct quadro_sample *history; /* Sample seq is at history[seq % QUADRO_HISTORY_LEN] */
+	u64 sample_seq;
+	bool removed;
+	wait_queue_head_t sample_wait;
+
+	/* Character device */
+	struct miscdevice misc;
+	char misc_name[16];
+	int misc_id;
+
+	/* Control report shadow and all I/O to the device, protected by ctrl_lock */
+	struct mutex ctrl_lock;
+	u8 ctrl_shadow[QUADRO_CTRL_REPORT_SIZE];
+	DECLARE_BITMAP(ctrl_dirty, QUADRO_CTRL_REPORT_SIZE); /* Bytes changed, not yet sent */
+	bool ctrl_valid;
+	unsigned long ctrl_fetched;
+	u64 ctrl_reads;
+	u64 ctrl_writes;
+	u64 ctrl_cache_hits;
+	u64 ctrl_conflicts; /* Writes that found the report changed by someone else */
+	u8 *ctrl_report; /* Transfer buffer */
+	u8 *secondary_ctrl_report;
+
+	/* Software sensors, centidegrees or QUADRO_SW_SENSOR_UNSET */
+	s16 sw_sensor[QUADRO_NUM_SW_SENSORS];
+	bool sw_dirty;
+	u8 *sw_report;
+	struct delayed_work sw_work;
 };
 
+/* Converts between hwmon pwm (0-255) and the device's centipercent */
+static u16 quadro_pwm_to_percent(long val)
+{
+	return DIV_ROUND_CLOSEST(clamp_val(val, 0, 255) * 100 * 100, 255);
+}
+
+static long quadro_percent_to_pwm(u16 val)
+{
+	return DIV_ROUND_CLOSEST(min_t(u16, val, 100 * 100) * 255, 100 * 100);
+}
+
+/* Reads the control report from the device, called with priv->ctrl_lock held */
+static int quadro_ctrl_read(struct quadro_data *priv)
+{
+	int ret;
+
+	ret = hid_hw_raw_request(priv->hdev, QUADRO_CTRL_REPORT_ID, priv->ctrl_report,
+				 QUADRO_CTRL_REPORT_SIZE, HID_FEATURE_REPORT, HID_REQ_GET_REPORT);
+	if (ret < 0)
+		return ret;
+
+	return ret == QUADRO_CTRL_REPORT_SIZE ? 0 : -EIO;
+}
+
+/*
+ * Writes the control report to the device in a single transfer and makes the device
+ * apply it, called with priv->ctrl_lock held
+ */
+static int quadro_ctrl_send(struct quadro_data *priv)
+{
+	u16 checksum;
+	int ret;
+
+	checksum = crc16(0xffff, priv->ctrl_report + QUADRO_CTRL_CHECKSUM_START,
+			 QUADRO_CTRL_CHECKSUM_LENGTH) ^ 0xffff;
+	put_unaligned_be16(checksum, priv->ctrl_report + QUADRO_CTRL_CHECKSUM);
+
+	ret = hid_hw_raw_request(priv->hdev, QUADRO_CTRL_REPORT_ID, priv->ctrl_report,
+				 QUADRO_CTRL_REPORT_SIZE, HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+	if (ret < 0)
+		return ret;
+
+	memcpy(priv->secondary_ctrl_report, quadro_secondary_ctrl_report,
+	       QUADRO_SECONDARY_CTRL_REPORT_SIZE);
+
+	ret = hid_hw_raw_request(priv->hdev, QUADRO_SECONDARY_CTRL_REPORT_ID,
+				 priv->secondary_ctrl_report, QUADRO_SECONDARY_CTRL_REPORT_SIZE,
+				 HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Makes sure the shadow holds the control report, reading it from the device if it
+ * is older than QUADRO_CTRL_CACHE_TIME. Called with priv->ctrl_lock held.
+ */
+static int quadro_ctrl_get(struct quadro_data *priv)
+{
+	int ret;
+
+	if (priv->ctrl_valid && time_before(jiffies, priv->ctrl_fetched + QUADRO_CTRL_CACHE_TIME)) {
+		priv->ctrl_cache_hits++;
+		return 0;
+	}
+
+	ret = quadro_ctrl_read(priv);
+	if (ret) {
+		priv->ctrl_valid = false;
+		return ret;
+	}
+
+	priv->ctrl_reads++;
+	memcpy(priv->ctrl_shadow, priv->ctrl_report, QUADRO_CTRL_REPORT_SIZE);
+	priv->ctrl_valid = true;
+	priv->ctrl_fetched = jiffies;
+
+	return 0;
+}
+
+/* Change fields in the shadow and mark them for the next commit */
+static void quadro_ctrl_set_u8(struct quadro_data *priv, int offset, u8 val)
+{
+	priv->ctrl_shadow[offset] = val;
+	set_bit(offset, priv->ctrl_dirty);
+}
+
+static void quadro_ctrl_set_be16(struct quadro_data *priv, int offset, u16 val)
+{
+	put_unaligned_be16(val, priv->ctrl_shadow + offset);
+	bitmap_set(priv->ctrl_dirty, offset, 2);
+}
+
+/*
+ * Sends the fields changed in the shadow to the device. The current report is read
+ * first and only the changed bytes are merged into it, so concurrent changes made
+ * through hidraw are kept. Called with priv->ctrl_lock held.
+ */
+static int quadro_ctrl_commit(struct quadro_data *priv)
+{
+	unsigned long i;
+	int ret;
+
+	ret = quadro_ctrl_read(priv);
+	if (ret)
+		goto out;
+
+	priv->ctrl_reads++;
+
+	if (priv->ctrl_valid) {
+		for (i = 0; i < QUADRO_CTRL_CHECKSUM; i++) {
+			if (!test_bit(i, priv->ctrl_dirty) &&
+			    priv->ctrl_report[i] != priv->ctrl_shadow[i]) {
+				priv->ctrl_conflicts++;
+				hid_dbg(priv->hdev, "control report changed outside of the driver\n");
+				break;
+			}
+		}
+	}
+
+	for_each_set_bit(i, priv->ctrl_dirty, QUADRO_CTRL_REPORT_SIZE)
+		priv->ctrl_report[i] = priv->ctrl_shadow[i];
+
+	ret = quadro_ctrl_send(priv);
+	if (ret)
+		goto out;
+
+	priv->ctrl_writes++;
+	memcpy(priv->ctrl_shadow, priv->ctrl_report, QUADRO_CTRL_REPORT_SIZE);
+	priv->ctrl_fetched = jiffies;
+
+out:
+	/* On failure the shadow holds changes the device never got */
+	priv->ctrl_valid = !ret;
+	bitmap_zero(priv->ctrl_dirty, QUADRO_CTRL_REPORT_SIZE);
+
+	return ret;
+}
+
+static u8 *quadro_ctrl_fan(struct quadro_data *priv, int fan)
+{
+	return priv->ctrl_shadow + quadro_ctrl_fan_offsets[fan];
+}
+
+static int quadro_read_pwm(struct quadro_data *priv, u32 attr, int channel, long *val)
+{
+	u8 *fan;
+	int ret;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	ret = quadro_ctrl_get(priv);
+	if (ret)
+		goto unlock;
+
+	fan = quadro_ctrl_fan(priv, channel);
+
+	switch (attr) {
+	case hwmon_pwm_input:
+		*val = quadro_percent_to_pwm(get_unaligned_be16(fan + QUADRO_FAN_CTRL_PWM));
+		break;
+	case hwmon_pwm_enable:
+		*val = fan[QUADRO_FAN_CTRL_MODE] + 1;
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+
+unlock:
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret;
+}
+
+static int quadro_write(struct device *dev, enum hwmon_sensor_types type, u32 attr, int channel,
+			long val)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int offset, ret;
+
+	if (type != hwmon_pwm)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+	case hwmon_pwm_input:
+		if (val < 0 || val > 255)
+			return -EINVAL;
+		break;
+	case hwmon_pwm_enable:
+		if (val < QUADRO_FAN_MODE_MANUAL + 1 || val > QUADRO_FAN_MODE_FOLLOW + 1)
+			return -EINVAL;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	offset = quadro_ctrl_fan_offsets[channel];
+
+	mutex_lock(&priv->ctrl_lock);
+
+	if (attr == hwmon_pwm_input)
+		quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_PWM, quadro_pwm_to_percent(val));
+	else
+		quadro_ctrl_set_u8(priv, offset + QUADRO_FAN_CTRL_MODE, val - 1);
+
+	ret = quadro_ctrl_commit(priv);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret;
+}
+
 static umode_t quadro_is_visible(const void *data, enum hwmon_sensor_types type, u32 attr,
 				 int channel)
 {
+	if (type == hwmon_pwm)
+		return 0644;
+
 	return 0444;
 }
 
-static int quadro_read(struct device *dev, enum hwmon_sensor_types type, u32 attr, int channel,
-		       long *val)
+static int quadro_derived_index(enum hwmon_sensor_types type, int channel)
 {
-	struct quadro_data *priv = dev_get_drvdata(dev);
+	int i;
 
-	if (time_after(jiffies, priv->updated + QUADRO_STATUS_UPDATE_INTERVAL))
-		return -ENODATA;
+	for (i = 0; i < QUADRO_NUM_DERIVED; i++)
+		if (quadro_derived_channels[i].type == type &&
+		    quadro_derived_channels[i].channel == channel)
+			return i;
+
+	return -1;
+}
+
+static bool quadro_derived_enabled(struct quadro_data *priv, int index)
+{
+	int i;
+
+	for (i = 0; i < QUADRO_DERIVED_TERMS; i++)
+		if (priv->derived_coeffs[index][i])
+			return true;
+
+	return false;
+}
+
+/* Called with priv->lock held */
+static int quadro_get_input(struct quadro_data *priv, enum hwmon_sensor_types type, int channel,
+			    long *val)
+{
+	int derived = quadro_derived_index(type, channel);
+
+	if (derived >= 0) {
+		if (!quadro_derived_enabled(priv, derived))
+			return -ENODATA;
+
+		*val = priv->derived_input[derived];
+		return 0;
+	}
 
 	switch (type) {
 	case hwmon_temp:
-		*val = priv->temp_input[channel];
+		*val = priv->status.temp[channel];
 		break;
 	case hwmon_fan:
-		*val = priv->speed_input[channel];
+		*val = priv->status.speed[channel];
 		break;
 	case hwmon_power:
-		*val = priv->power_input[channel];
+		*val = priv->status.power[channel];
 		break;
 	case hwmon_in:
-		*val = priv->voltage_input[channel];
+		*val = priv->status.voltage[channel];
 		break;
 	case hwmon_curr:
-		*val = priv->current_input[channel];
+		*val = priv->status.curr[channel];
 		break;
 	default:
 		return -EOPNOTSUPP;
@@ -174,6 +728,37 @@ static int quadro_read(struct device *dev, enum hwmon_sensor_types type, u32 att
 	return 0;
 }
 
+static int quadro_read(struct device *dev, enum hwmon_sensor_types type, u32 attr, int channel,
+		       long *val)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int ret;
+
+	if (type == hwmon_pwm)
+		return quadro_read_pwm(priv, attr, channel, val);
+
+	mutex_lock(&priv->lock);
+
+	if (time_after(jiffies, priv->updated + QUADRO_STATUS_UPDATE_INTERVAL)) {
+		ret = -ENODATA;
+	} else if (type == hwmon_fan && attr == hwmon_fan_fault) {
+		*val = priv->fan_fault[channel - 1];
+		ret = 0;
+	} else if (type == hwmon_temp && attr == hwmon_temp_alarm) {
+		*val = priv->ewma[channel].alarm;
+		ret = 0;
+	} else if (type == hwmon_fan && attr == hwmon_fan_alarm) {
+		*val = priv->ewma[QUADRO_ANOMALY_FLOW].alarm;
+		ret = 0;
+	} else {
+		ret = quadro_get_input(priv, type, channel, val);
+	}
+
+	mutex_unlock(&priv->lock);
+
+	return ret;
+}
+
 static int quadro_read_string(struct device *dev, enum hwmon_sensor_types type, u32 attr,
 			      int channel, const char **str)
 {
@@ -204,19 +789,29 @@ static const struct hwmon_ops quadro_hwmon_ops = {
 	.is_visible = quadro_is_visible,
 	.read = quadro_read,
 	.read_string = quadro_read_string,
+	.write = quadro_write,
 };
 
 static const struct hwmon_channel_info *quadro_info[] = {
-	HWMON_CHANNEL_INFO(temp, HWMON_T_INPUT | HWMON_T_LABEL, HWMON_T_INPUT | HWMON_T_LABEL,
-	 			HWMON_T_INPUT | HWMON_T_LABEL, HWMON_T_INPUT | HWMON_T_LABEL),
-	HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT | HWMON_F_LABEL, HWMON_F_INPUT | HWMON_F_LABEL,
-				HWMON_F_INPUT | HWMON_F_LABEL, HWMON_F_INPUT | HWMON_F_LABEL, HWMON_F_INPUT | HWMON_F_LABEL),
+	HWMON_CHANNEL_INFO(temp, HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_ALARM,
+				HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_ALARM,
+				HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_ALARM,
+				HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_ALARM,
+				HWMON_T_INPUT | HWMON_T_LABEL, HWMON_T_INPUT | HWMON_T_LABEL),
+	HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_ALARM,
+				HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_FAULT,
+				HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_FAULT,
+				HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_FAULT,
+				HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_FAULT),
 	HWMON_CHANNEL_INFO(power, HWMON_P_INPUT | HWMON_P_LABEL, HWMON_P_INPUT | HWMON_P_LABEL,
-				HWMON_P_INPUT | HWMON_P_LABEL, HWMON_P_INPUT | HWMON_P_LABEL),
+				HWMON_P_INPUT | HWMON_P_LABEL, HWMON_P_INPUT | HWMON_P_LABEL,
+				HWMON_P_INPUT | HWMON_P_LABEL),
 	HWMON_CHANNEL_INFO(in, HWMON_I_INPUT | HWMON_I_LABEL, HWMON_I_INPUT | HWMON_I_LABEL,
 			   	HWMON_I_INPUT | HWMON_I_LABEL, HWMON_I_INPUT | HWMON_I_LABEL, HWMON_I_INPUT | HWMON_I_LABEL),
 	HWMON_CHANNEL_INFO(curr, HWMON_C_INPUT | HWMON_C_LABEL, HWMON_C_INPUT | HWMON_C_LABEL,
 				HWMON_C_INPUT | HWMON_C_LABEL, HWMON_C_INPUT | HWMON_C_LABEL),
+	HWMON_CHANNEL_INFO(pwm, HWMON_PWM_INPUT | HWMON_PWM_ENABLE, HWMON_PWM_INPUT | HWMON_PWM_ENABLE,
+				HWMON_PWM_INPUT | HWMON_PWM_ENABLE, HWMON_PWM_INPUT | HWMON_PWM_ENABLE),
 	NULL
 };
 
@@ -225,144 +820,2305 @@ static const struct hwmon_chip_info quadro_chip_info = {
 	.info = quadro_info,
 };
 
-static int quadro_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+static void quadro_timing_add(struct quadro_timing *timing, u64 ns)
 {
-	struct quadro_data *priv;
+	timing->count++;
+	timing->total_ns += ns;
+	if (ns > timing->max_ns)
+		timing->max_ns = ns;
+}
 
-	if (report->id != QUADRO_STATUS_REPORT_ID)
-		return 0;
+/* Called with priv->lock held */
+static void quadro_update_derived(struct quadro_data *priv)
+{
+	s64 sum;
+	int i, j;
 
-	priv = hid_get_drvdata(hdev);
+	for (i = 0; i < QUADRO_NUM_DERIVED; i++) {
+		sum = 0;
+
+		for (j = 0; j < QUADRO_DERIVED_TERMS; j++) {
+			if (quadro_derived_channels[i].type == hwmon_temp)
+				sum += (s64)priv->derived_coeffs[i][j] * priv->status.temp[j];
+			else
+				sum += (s64)priv->derived_coeffs[i][j] * priv->status.power[j];
+		}
 
-	/* Info provided with every report */
+		priv->derived_input[i] = div_s64(sum, QUADRO_DERIVED_SCALE);
+	}
+}
 
-	priv->serial_number[0] = get_unaligned_be16(data + QUADRO_SERIAL_FIRST_PART);
-	priv->serial_number[1] = get_unaligned_be16(data + QUADRO_SERIAL_SECOND_PART);
+/*
+ * Credit the time since the previous report to the buckets of the speeds and duties
+ * it reported. Called with priv->lock held, before the new readings are stored.
+ */
+static void quadro_update_residency(struct quadro_data *priv, u64 timestamp)
+{
+	u64 delta;
+	int i, bucket;
 
-	priv->firmware_version = get_unaligned_be16(data + QUADRO_FIRMWARE_VERSION);
-	priv->power_cycles = get_unaligned_be32(data + QUADRO_POWER_CYCLES);
+	if (!priv->timestamp)
+		return;
 
-	/* Sensor readings */
+	/* Don't count gaps in which the device was unplugged or stalled */
+	delta = min_t(u64, timestamp - priv->timestamp,
+		      jiffies_to_nsecs(QUADRO_STATUS_UPDATE_INTERVAL));
 
-	priv->temp_input[0] = get_unaligned_be16(data + QUADRO_TEMP1) * 10;
-	priv->temp_input[1] = get_unaligned_be16(data + QUADRO_TEMP2) * 10;
-	priv->temp_input[2] = get_unaligned_be16(data + QUADRO_TEMP3) * 10;
-	priv->temp_input[3] = get_unaligned_be16(data + QUADRO_TEMP4) * 10;
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		bucket = min(priv->status.speed[i + 1] / QUADRO_RPM_BUCKET_WIDTH,
+			     QUADRO_RPM_BUCKETS - 1);
+		priv->rpm_residency[i][bucket] += delta;
 
-	priv->speed_input[0] = get_unaligned_be16(data + QUADRO_FLOW_SPEED) / 10;
-	priv->speed_input[1] = get_unaligned_be16(data + QUADRO_FAN1_SPEED);
-	priv->speed_input[2] = get_unaligned_be16(data + QUADRO_FAN2_SPEED);
-	priv->speed_input[3] = get_unaligned_be16(data + QUADRO_FAN3_SPEED);
-	priv->speed_input[4] = get_unaligned_be16(data + QUADRO_FAN4_SPEED);
+		bucket = min(priv->status.duty[i] / QUADRO_DUTY_BUCKET_WIDTH,
+			     QUADRO_DUTY_BUCKETS - 1);
+		priv->duty_residency[i][bucket] += delta;
+	}
+}
 
-	priv->power_input[0] = get_unaligned_be16(data + QUADRO_FAN1_POWER) * 10000;
-	priv->power_input[1] = get_unaligned_be16(data + QUADRO_FAN2_POWER) * 10000;
-	priv->power_input[2] = get_unaligned_be16(data + QUADRO_FAN3_POWER) * 10000;
-	priv->power_input[3] = get_unaligned_be16(data + QUADRO_FAN4_POWER) * 10000;
+/* Called with priv->lock held */
+static void quadro_log_event(struct quadro_data *priv, enum quadro_event_type type, int channel,
+			     long value)
+{
+	struct quadro_event *event = &priv->events[priv->event_count++ % QUADRO_EVENT_LOG_LEN];
 
-	priv->voltage_input[0] = get_unaligned_be16(data + QUADRO_VOLTAGE) * 10;
-	priv->voltage_input[1] = get_unaligned_be16(data + QUADRO_FAN1_VOLTAGE) * 10;
-	priv->voltage_input[2] = get_unaligned_be16(data + QUADRO_FAN2_VOLTAGE) * 10;
-	priv->voltage_input[3] = get_unaligned_be16(data + QUADRO_FAN3_VOLTAGE) * 10;
-	priv->voltage_input[4] = get_unaligned_be16(data + QUADRO_FAN4_VOLTAGE) * 10;
+	event->timestamp = ktime_get_ns();
+	event->type = type;
+	event->channel = channel;
+	event->value = value;
+}
 
-	priv->current_input[0] = get_unaligned_be16(data + QUADRO_FAN1_CURRENT);
-	priv->current_input[1] = get_unaligned_be16(data + QUADRO_FAN2_CURRENT);
-	priv->current_input[2] = get_unaligned_be16(data + QUADRO_FAN3_CURRENT);
-	priv->current_input[3] = get_unaligned_be16(data + QUADRO_FAN4_CURRENT);
+/*
+ * A fan is stalled when it runs slower than fan_stall_rpm while the device drives it,
+ * judged by its actual duty or, if enabled, its current draw. Only fans that ran at
+ * fan_stall_rpm since probe or the last reboot count, the device drives unpopulated headers
+ * as well. fanX_fault follows after fan_stall_reports consecutive stalled reports and clears
+ * with the first good one. Called with priv->lock held.
+ */
+static void quadro_update_stall(struct quadro_data *priv)
+{
+	bool driven, stalled, fault;
+	int i;
 
-	priv->updated = jiffies;
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		if (priv->status.speed[i + 1] >= fan_stall_rpm)
+			priv->fan_seen[i] = true;
 
-	return 0;
-}
+		driven = priv->status.duty[i] >= fan_stall_duty * 100 ||
+			 (fan_stall_current && priv->status.curr[i] >= fan_stall_current);
+		stalled = priv->fan_seen[i] && driven && priv->status.speed[i + 1] < fan_stall_rpm;
 
-#ifdef CONFIG_DEBUG_FS
+		if (stalled && priv->stall_count[i] < fan_stall_reports)
+			priv->stall_count[i]++;
+		else if (!stalled)
+			priv->stall_count[i] = 0;
 
-static int serial_number_show(struct seq_file *seqf, void *unused)
-{
-	struct quadro_data *priv = seqf->private;
+		fault = stalled && priv->stall_count[i] >= fan_stall_reports;
+		if (fault == priv->fan_fault[i])
+			continue;
 
-	seq_printf(seqf, "%05u-%05u\n", priv->serial_number[0], priv->serial_number[1]);
+		priv->fan_fault[i] = fault;
+		quadro_log_event(priv, QUADRO_EVENT_FAN_FAULT, i + 1, fault);
 
-	return 0;
+		if (priv->hwmon_dev)
+			hwmon_notify_event(priv->hwmon_dev, hwmon_fan, hwmon_fan_fault, i + 1);
+	}
 }
-DEFINE_SHOW_ATTRIBUTE(serial_number);
 
-static int firmware_version_show(struct seq_file *seqf, void *unused)
+/*
+ * Flags temperature excursions and flow drops. The alarm is set with the first anomalous
+ * report and cleared with the first one back near the readings from before, which the
+ * statistics are frozen at meanwhile. Called with priv->lock held.
+ */
+static void quadro_update_anomaly(struct quadro_data *priv)
 {
-	struct quadro_data *priv = seqf->private;
+	struct quadro_ewma *ewma;
+	bool anomaly;
+	int i;
 
-	seq_printf(seqf, "%u\n", priv->firmware_version);
+	for (i = 0; i < QUADRO_ANOMALY_CHANNELS; i++) {
+		ewma = &priv->ewma[i];
 
-	return 0;
-}
-DEFINE_SHOW_ATTRIBUTE(firmware_version);
+		if (i == QUADRO_ANOMALY_FLOW)
+			anomaly = quadro_ewma_add(ewma, priv->status.speed[0],
+						  QUADRO_ANOMALY_FLOW_MIN_STD, anomaly_z, true);
+		else
+			anomaly = quadro_ewma_add(ewma, priv->status.temp[i],
+						  QUADRO_ANOMALY_TEMP_MIN_STD, anomaly_z, false);
 
-static int power_cycles_show(struct seq_file *seqf, void *unused)
-{
-	struct quadro_data *priv = seqf->private;
+		if (anomaly == ewma->alarm)
+			continue;
 
-	seq_printf(seqf, "%u\n", priv->power_cycles);
+		if (anomaly)
+			ewma->anomalies++;
 
-	return 0;
+		ewma->alarm = anomaly;
+		quadro_log_event(priv, QUADRO_EVENT_ANOMALY, i, anomaly);
+
+		if (!priv->hwmon_dev)
+			continue;
+
+		if (i == QUADRO_ANOMALY_FLOW)
+			hwmon_notify_event(priv->hwmon_dev, hwmon_fan, hwmon_fan_alarm, 0);
+		else
+			hwmon_notify_event(priv->hwmon_dev, hwmon_temp, hwmon_temp_alarm, i);
+	}
 }
-DEFINE_SHOW_ATTRIBUTE(power_cycles);
 
-static void quadro_debugfs_init(struct quadro_data *priv)
+/*
+ * Notify the input channels selected by the notification policy for the report
+ * just decoded. Called with priv->lock held.
+ */
+static void quadro_notify(struct quadro_data *priv)
 {
-	char name[32];
+	bool all = false;
+	long val;
+	int i, j;
 
-	scnprintf(name, sizeof(name), "%s-%s", DRIVER_NAME, dev_name(&priv->hdev->dev));
+	if (priv->notify_interval && ++priv->notify_count >= priv->notify_interval) {
+		priv->notify_count = 0;
+		all = true;
+	}
 
-	priv->debugfs = debugfs_create_dir(name, NULL);
-	debugfs_create_file("serial_number", 0444, priv->debugfs, priv, &serial_number_fops);
-	debugfs_create_file("firmware_version", 0444, priv->debugfs, priv, &firmware_version_fops);
-	debugfs_create_file("power_cycles", 0444, priv->debugfs, priv, &power_cycles_fops);
-}
+	for (i = 0; i < QUADRO_NUM_INPUT_TYPES; i++) {
+		if (!all && !priv->notify_delta[i])
+			continue;
 
-#else
+		for (j = 0; j < quadro_input_types[i].channels; j++) {
+			if (quadro_get_input(priv, quadro_input_types[i].type, j, &val))
+				continue;
 
-static void quadro_debugfs_init(struct quadro_data *priv)
-{
+			if (!all && abs(val - priv->notified_value[i][j]) <= priv->notify_delta[i])
+				continue;
+
+			priv->notified_value[i][j] = val;
+			hwmon_notify_event(priv->hwmon_dev, quadro_input_types[i].type,
+					   quadro_input_types[i].attr, j);
+		}
+	}
 }
 
-#endif
+#if IS_ENABLED(CONFIG_THERMAL)
 
-static int quadro_probe(struct hid_device *hdev, const struct hid_device_id *id)
+static int quadro_tz_get_temp(struct thermal_zone_device *tz, int *temp)
 {
-	struct quadro_data *priv;
-	int ret;
+	struct quadro_thermal *zone = thermal_zone_device_priv(tz);
+	struct quadro_data *priv = zone->priv;
+	int ret = 0;
 
-	priv = devm_kzalloc(&hdev->dev, sizeof(*priv), GFP_KERNEL);
-	if (!priv)
-		return -ENOMEM;
+	mutex_lock(&priv->lock);
 
-	priv->hdev = hdev;
-	hid_set_drvdata(hdev, priv);
+	/*
+	 * Before the first report and while the device is stale. The thermal core only
+	 * stays quiet about -EAGAIN and retries with the next update.
+	 */
+	if (time_after(jiffies, priv->updated + QUADRO_STATUS_UPDATE_INTERVAL))
+		ret = -EAGAIN;
+	else
+		*temp = priv->status.temp[zone->channel];
 
-	priv->updated = jiffies - QUADRO_STATUS_UPDATE_INTERVAL;
+	mutex_unlock(&priv->lock);
 
-	ret = hid_parse(hdev);
-	if (ret)
+	return ret;
+}
+
+static bool quadro_is_own_cdev(struct quadro_data *priv, struct thermal_cooling_device *cdev)
+{
+	int i;
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++)
+		if (cdev->devdata == &priv->cooling[i])
+			return true;
+
+	return false;
+}
+
+static int quadro_tz_bind(struct thermal_zone_device *tz, struct thermal_cooling_device *cdev)
+{
+	struct quadro_thermal *zone = thermal_zone_device_priv(tz);
+
+	if (!thermal_bind || !quadro_is_own_cdev(zone->priv, cdev))
+		return 0;
+
+	return thermal_zone_bind_cooling_device(tz, 0, cdev, THERMAL_NO_LIMIT, THERMAL_NO_LIMIT,
+						THERMAL_WEIGHT_DEFAULT);
+}
+
+static int quadro_tz_unbind(struct thermal_zone_device *tz, struct thermal_cooling_device *cdev)
+{
+	struct quadro_thermal *zone = thermal_zone_device_priv(tz);
+
+	if (!thermal_bind || !quadro_is_own_cdev(zone->priv, cdev))
+		return 0;
+
+	return thermal_zone_unbind_cooling_device(tz, 0, cdev);
+}
+
+static struct thermal_zone_device_ops quadro_tz_ops = {
+	.bind = quadro_tz_bind,
+	.unbind = quadro_tz_unbind,
+	.get_temp = quadro_tz_get_temp,
+};
+
+static int quadro_cdev_get_max_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	*state = QUADRO_COOLING_STATES;
+
+	return 0;
+}
+
+/* Reports the duty the fan actually runs at, whoever sets it */
+static int quadro_cdev_get_cur_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	struct quadro_cooling *cooling = cdev->devdata;
+	struct quadro_data *priv = cooling->priv;
+	u16 duty;
+
+	mutex_lock(&priv->lock);
+	duty = priv->status.duty[cooling->fan];
+	mutex_unlock(&priv->lock);
+
+	*state = DIV_ROUND_CLOSEST(min_t(u16, duty, 100 * 100) * QUADRO_COOLING_STATES, 100 * 100);
+
+	return 0;
+}
+
+/* Hands the fan back to the mode and duty it had before it was claimed */
+static int quadro_cdev_release(struct quadro_cooling *cooling)
+{
+	struct quadro_data *priv = cooling->priv;
+	int offset = quadro_ctrl_fan_offsets[cooling->fan];
+	int ret;
+
+	if (!cooling->claimed)
+		return 0;
+
+	quadro_ctrl_set_u8(priv, offset + QUADRO_FAN_CTRL_MODE, cooling->saved_mode);
+	quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_PWM, cooling->saved_pwm);
+	ret = quadro_ctrl_commit(priv);
+	if (!ret)
+		cooling->claimed = false;
+
+	return ret;
+}
+
+/*
+ * States 1-10 switch the fan to manual mode with 10-100% duty in a single write. The
+ * mode and duty it had are saved when it is first claimed, and state 0 restores them.
+ */
+static int quadro_cdev_set_cur_state(struct thermal_cooling_device *cdev, unsigned long state)
+{
+	struct quadro_cooling *cooling = cdev->devdata;
+	struct quadro_data *priv = cooling->priv;
+	int offset = quadro_ctrl_fan_offsets[cooling->fan];
+	u8 *fan;
+	int ret;
+
+	if (state > QUADRO_COOLING_STATES)
+		return -EINVAL;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	if (!state) {
+		ret = quadro_cdev_release(cooling);
+		goto unlock;
+	}
+
+	if (!cooling->claimed) {
+		ret = quadro_ctrl_get(priv);
+		if (ret)
+			goto unlock;
+
+		fan = quadro_ctrl_fan(priv, cooling->fan);
+		cooling->saved_mode = fan[QUADRO_FAN_CTRL_MODE];
+		cooling->saved_pwm = get_unaligned_be16(fan + QUADRO_FAN_CTRL_PWM);
+	}
+
+	quadro_ctrl_set_u8(priv, offset + QUADRO_FAN_CTRL_MODE, QUADRO_FAN_MODE_MANUAL);
+	quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_PWM,
+			     state * 100 * 100 / QUADRO_COOLING_STATES);
+	ret = quadro_ctrl_commit(priv);
+	if (!ret)
+		cooling->claimed = true;
+
+unlock:
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret;
+}
+
+static const struct thermal_cooling_device_ops quadro_cdev_ops = {
+	.get_max_state = quadro_cdev_get_max_state,
+	.get_cur_state = quadro_cdev_get_cur_state,
+	.set_cur_state = quadro_cdev_set_cur_state,
+};
+
+/*
+ * Registers each fan output as a cooling device. Like the thermal zones, failure only
+ * loses this interface.
+ */
+static void quadro_cooling_init(struct quadro_data *priv)
+{
+	struct thermal_cooling_device *cdev;
+	struct quadro_cooling *cooling;
+	char name[THERMAL_NAME_LENGTH];
+	int i;
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		cooling = &priv->cooling[i];
+		cooling->priv = priv;
+		cooling->fan = i;
+
+		scnprintf(name, sizeof(name), "quadro_fan%d", i + 1);
+
+		cdev = thermal_cooling_device_register(name, cooling, &quadro_cdev_ops);
+		if (IS_ERR(cdev)) {
+			hid_warn(priv->hdev, "failed to register cooling device %s: %ld\n", name,
+				 PTR_ERR(cdev));
+			continue;
+		}
+
+		cooling->cdev = cdev;
+	}
+}
+
+/* Must be called while the device can still be written to, claimed fans are released */
+static void quadro_cooling_remove(struct quadro_data *priv)
+{
+	int i;
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		if (priv->cooling[i].cdev)
+			thermal_cooling_device_unregister(priv->cooling[i].cdev);
+		priv->cooling[i].cdev = NULL;
+
+		mutex_lock(&priv->ctrl_lock);
+		quadro_cdev_release(&priv->cooling[i]);
+		mutex_unlock(&priv->ctrl_lock);
+	}
+}
+
+/*
+ * Registers a thermal zone for each of Temp1-4 with writable active and passive trip
+ * points. The zones are updated on every report instead of being polled. Failure is
+ * not fatal, the hwmon interface works without them.
+ */
+static void quadro_thermal_init(struct quadro_data *priv)
+{
+	struct thermal_zone_device *tz;
+	struct quadro_thermal *zone;
+	char name[THERMAL_NAME_LENGTH];
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(priv->thermal); i++) {
+		zone = &priv->thermal[i];
+		zone->priv = priv;
+		zone->channel = i;
+
+		zone->trips[0].temperature = trip_active;
+		zone->trips[0].hysteresis = QUADRO_TRIP_HYSTERESIS;
+		zone->trips[0].type = THERMAL_TRIP_ACTIVE;
+		zone->trips[1].temperature = trip_passive;
+		zone->trips[1].hysteresis = QUADRO_TRIP_HYSTERESIS;
+		zone->trips[1].type = THERMAL_TRIP_PASSIVE;
+
+		scnprintf(name, sizeof(name), "quadro_temp%d", i + 1);
+
+		tz = thermal_zone_device_register_with_trips(name, zone->trips, QUADRO_NUM_TRIPS,
+							     GENMASK(QUADRO_NUM_TRIPS - 1, 0), zone,
+							     &quadro_tz_ops, NULL, 0, 0);
+		if (IS_ERR(tz)) {
+			hid_warn(priv->hdev, "failed to register thermal zone %s: %ld\n", name,
+				 PTR_ERR(tz));
+			continue;
+		}
+
+		ret = thermal_zone_device_enable(tz);
+		if (ret) {
+			hid_warn(priv->hdev, "failed to enable thermal zone %s: %d\n", name, ret);
+			thermal_zone_device_unregister(tz);
+			continue;
+		}
+
+		/* Reports are already being decoded and update the zones registered so far */
+		WRITE_ONCE(zone->tz, tz);
+	}
+}
+
+/* Must not be called with priv->lock held, the zones read their temperature under it */
+static void quadro_thermal_update(struct quadro_data *priv)
+{
+	struct thermal_zone_device *tz;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(priv->thermal); i++) {
+		tz = READ_ONCE(priv->thermal[i].tz);
+		if (tz)
+			thermal_zone_device_update(tz, THERMAL_EVENT_TEMP_SAMPLE);
+	}
+}
+
+static void quadro_thermal_remove(struct quadro_data *priv)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(priv->thermal); i++) {
+		if (priv->thermal[i].tz)
+			thermal_zone_device_unregister(priv->thermal[i].tz);
+		priv->thermal[i].tz = NULL;
+	}
+}
+
+#else
+
+static void quadro_cooling_init(struct quadro_data *priv)
+{
+}
+
+static void quadro_cooling_remove(struct quadro_data *priv)
+{
+}
+
+static void quadro_thermal_init(struct quadro_data *priv)
+{
+}
+
+static void quadro_thermal_update(struct quadro_data *priv)
+{
+}
+
+static void quadro_thermal_remove(struct quadro_data *priv)
+{
+}
+
+#endif
+
+/* Flattens a sample into QUADRO_NUM_CHANNELS values, in the order of the channel mask bits */
+static void quadro_sample_values(const struct quadro_sample *sample, s32 *values)
+{
+	int i = 0, j;
+
+	for (j = 0; j < ARRAY_SIZE(sample->temp); j++)
+		values[i++] = sample->temp[j];
+	for (j = 0; j < ARRAY_SIZE(sample->speed); j++)
+		values[i++] = sample->speed[j];
+	for (j = 0; j < ARRAY_SIZE(sample->power); j++)
+		values[i++] = sample->power[j];
+	for (j = 0; j < ARRAY_SIZE(sample->voltage); j++)
+		values[i++] = sample->voltage[j];
+	for (j = 0; j < ARRAY_SIZE(sample->curr); j++)
+		values[i++] = sample->curr[j];
+}
+
+#if IS_ENABLED(CONFIG_IIO_KFIFO_BUF)
+
+/* The address holds the hwmon sensor type and channel the IIO channel mirrors */
+#define QUADRO_IIO_ADDRESS(type, channel)	((type) << 8 | (channel))
+
+#define QUADRO_IIO_CHAN(_type, _channel, _hwmon_type, _hwmon_channel, _scan_index, _info) {	\
+	.type = _type,										\
+	.indexed = 1,										\
+	.channel = _channel,									\
+	.address = QUADRO_IIO_ADDRESS(_hwmon_type, _hwmon_channel),				\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | (_info),					\
+	.scan_index = _scan_index,								\
+	.scan_type = {										\
+		.sign = 's',									\
+		.realbits = 32,									\
+		.storagebits = 32,								\
+		.endianness = IIO_CPU,								\
+	},											\
+}
+
+#define QUADRO_IIO_SCALE	BIT(IIO_CHAN_INFO_SCALE)
+
+/* Same order as the fields of struct quadro_sample */
+static const struct iio_chan_spec quadro_iio_channels[] = {
+	QUADRO_IIO_CHAN(IIO_TEMP, 0, hwmon_temp, 0, 0, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_TEMP, 1, hwmon_temp, 1, 1, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_TEMP, 2, hwmon_temp, 2, 2, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_TEMP, 3, hwmon_temp, 3, 3, QUADRO_IIO_SCALE),
+	/*
+	 * The flow sensor reports l/h, which IIO has no type for. It sits with the fans, but
+	 * without their scale to rad/s, which is per channel, so its raw value stays in l/h.
+	 */
+	QUADRO_IIO_CHAN(IIO_ANGL_VEL, 0, hwmon_fan, 0, 4, 0),
+	QUADRO_IIO_CHAN(IIO_ANGL_VEL, 1, hwmon_fan, 1, 5, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_ANGL_VEL, 2, hwmon_fan, 2, 6, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_ANGL_VEL, 3, hwmon_fan, 3, 7, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_ANGL_VEL, 4, hwmon_fan, 4, 8, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_POWER, 0, hwmon_power, 0, 9, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_POWER, 1, hwmon_power, 1, 10, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_POWER, 2, hwmon_power, 2, 11, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_POWER, 3, hwmon_power, 3, 12, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_VOLTAGE, 0, hwmon_in, 0, 13, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_VOLTAGE, 1, hwmon_in, 1, 14, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_VOLTAGE, 2, hwmon_in, 2, 15, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_VOLTAGE, 3, hwmon_in, 3, 16, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_VOLTAGE, 4, hwmon_in, 4, 17, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_CURRENT, 0, hwmon_curr, 0, 18, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_CURRENT, 1, hwmon_curr, 1, 19, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_CURRENT, 2, hwmon_curr, 2, 20, QUADRO_IIO_SCALE),
+	QUADRO_IIO_CHAN(IIO_CURRENT, 3, hwmon_curr, 3, 21, QUADRO_IIO_SCALE),
+	IIO_CHAN_SOFT_TIMESTAMP(22),
+};
+
+static_assert(ARRAY_SIZE(quadro_iio_channels) == QUADRO_NUM_CHANNELS + 1);
+
+/* Reports always carry all channels, the core picks out the enabled ones */
+static const unsigned long quadro_iio_scan_masks[] = { GENMASK(QUADRO_NUM_CHANNELS - 1, 0), 0 };
+
+static int quadro_iio_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+			       int *val, int *val2, long mask)
+{
+	struct quadro_data *priv = *(struct quadro_data **)iio_priv(indio_dev);
+	long input;
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		mutex_lock(&priv->lock);
+
+		if (time_after(jiffies, priv->updated + QUADRO_STATUS_UPDATE_INTERVAL))
+			ret = -ENODATA;
+		else
+			ret = quadro_get_input(priv, chan->address >> 8, chan->address & 0xff,
+					       &input);
+
+		mutex_unlock(&priv->lock);
+
+		if (ret)
+			return ret;
+
+		*val = input;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		switch (chan->type) {
+		case IIO_ANGL_VEL:
+			/* RPM to rad/s */
+			*val = 0;
+			*val2 = 104719755;
+			return IIO_VAL_INT_PLUS_NANO;
+		case IIO_POWER:
+			/* uW to mW */
+			*val = 0;
+			*val2 = 1000;
+			return IIO_VAL_INT_PLUS_MICRO;
+		default:
+			/* hwmon and IIO both use milli units for the others */
+			*val = 1;
+			return IIO_VAL_INT;
+		}
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info quadro_iio_info = {
+	.read_raw = quadro_iio_read_raw,
+};
+
+/* Like debugfs, the IIO device is optional and failure only loses it */
+static void quadro_iio_init(struct quadro_data *priv)
+{
+	struct iio_dev *indio_dev;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(&priv->hdev->dev, sizeof(priv));
+	if (!indio_dev)
+		return;
+
+	*(struct quadro_data **)iio_priv(indio_dev) = priv;
+
+	indio_dev->name = "quadro";
+	indio_dev->info = &quadro_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = quadro_iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(quadro_iio_channels);
+	indio_dev->available_scan_masks = quadro_iio_scan_masks;
+
+	ret = devm_iio_kfifo_buffer_setup(&priv->hdev->dev, indio_dev, NULL);
+	if (ret)
+		goto fail;
+
+	/* Timestamps are taken with ktime_get_ns() when the report arrives */
+	ret = iio_device_set_clock(indio_dev, CLOCK_MONOTONIC);
+	if (ret)
+		goto fail;
+
+	/* Not devm managed, it has to be gone before priv is released in quadro_remove() */
+	ret = iio_device_register(indio_dev);
+	if (ret)
+		goto fail;
+
+	/* quadro_iio_push() runs under the lock as reports are decoded */
+	mutex_lock(&priv->lock);
+	priv->indio_dev = indio_dev;
+	mutex_unlock(&priv->lock);
+	return;
+
+fail:
+	hid_warn(priv->hdev, "failed to register IIO device: %d\n", ret);
+}
+
+/* Called with priv->lock held, after the sample has been recorded */
+static void quadro_iio_push(struct quadro_data *priv)
+{
+	const struct quadro_sample *sample = &priv->history[priv->sample_seq % QUADRO_HISTORY_LEN];
+	struct {
+		s32 values[QUADRO_NUM_CHANNELS];
+		s64 timestamp __aligned(8);
+	} scan;
+
+	if (!priv->indio_dev || !iio_buffer_enabled(priv->indio_dev))
+		return;
+
+	memset(&scan, 0, sizeof(scan));
+	quadro_sample_values(sample, scan.values);
+
+	iio_push_to_buffers_with_timestamp(priv->indio_dev, &scan, sample->timestamp_ns);
+}
+
+static void quadro_iio_remove(struct quadro_data *priv)
+{
+	if (priv->indio_dev)
+		iio_device_unregister(priv->indio_dev);
+	priv->indio_dev = NULL;
+}
+
+#else
+
+static void quadro_iio_init(struct quadro_data *priv)
+{
+}
+
+static void quadro_iio_push(struct quadro_data *priv)
+{
+}
+
+static void quadro_iio_remove(struct quadro_data *priv)
+{
+}
+
+#endif
+
+/* Called with priv->lock held */
+static void quadro_record_sample(struct quadro_data *priv)
+{
+	struct quadro_sample *sample;
+	int i;
+
+	priv->sample_seq++;
+	sample = &priv->history[priv->sample_seq % QUADRO_HISTORY_LEN];
+
+	memset(sample, 0, sizeof(*sample));
+	sample->seq = priv->sample_seq;
+	sample->timestamp_ns = priv->timestamp;
+	sample->next_timestamp_ns = priv->period ? priv->timestamp + priv->period : 0;
+
+	for (i = 0; i < ARRAY_SIZE(sample->temp); i++)
+		sample->temp[i] = priv->status.temp[i];
+	for (i = 0; i < ARRAY_SIZE(sample->speed); i++)
+		sample->speed[i] = priv->status.speed[i];
+	for (i = 0; i < ARRAY_SIZE(sample->power); i++)
+		sample->power[i] = priv->status.power[i];
+	for (i = 0; i < ARRAY_SIZE(sample->voltage); i++)
+		sample->voltage[i] = priv->status.voltage[i];
+	for (i = 0; i < ARRAY_SIZE(sample->curr); i++)
+		sample->curr[i] = priv->status.curr[i];
+
+	sample->power_cycles = priv->status.power_cycles;
+	sample->firmware_version = priv->status.firmware_version;
+}
+
+/*
+ * Logs changes of the firmware version and power cycles and returns whether the
+ * device rebooted since the previous report. Called with priv->lock held, before the
+ * new readings replace priv->status.
+ */
+static bool quadro_check_device(struct quadro_data *priv, const struct quadro_status *status)
+{
+	/* Nothing to compare the first report with */
+	if (!priv->timestamp)
+		return false;
+
+	if (status->firmware_version != priv->status.firmware_version)
+		quadro_log_event(priv, QUADRO_EVENT_FIRMWARE, 0, status->firmware_version);
+
+	if (status->power_cycles != priv->status.power_cycles)
+		quadro_log_event(priv, QUADRO_EVENT_POWER_CYCLES, 0, status->power_cycles);
+
+	return status->power_cycles > priv->status.power_cycles;
+}
+
+/*
+ * The device lost its state in a reboot: start the running statistics over and send
+ * the software sensors again. Alarms and faults are reevaluated, and cleared if need
+ * be, with the report being decoded. Called with priv->lock held.
+ */
+static void quadro_handle_reboot(struct quadro_data *priv)
+{
+	int i;
+
+	for (i = 0; i < QUADRO_ANOMALY_CHANNELS; i++) {
+		priv->ewma[i].mean = 0;
+		priv->ewma[i].var = 0;
+		priv->ewma[i].samples = 0;
+	}
+
+	memset(priv->stall_count, 0, sizeof(priv->stall_count));
+	memset(priv->fan_seen, 0, sizeof(priv->fan_seen));
+
+	for (i = 0; i < QUADRO_NUM_SW_SENSORS; i++)
+		if (priv->sw_sensor[i] != QUADRO_SW_SENSOR_UNSET)
+			priv->sw_dirty = true;
+
+	/* Cleared under the lock before the work item is cancelled in quadro_remove() */
+	if (priv->sw_dirty && priv->hwmon_dev)
+		schedule_delayed_work(&priv->sw_work, 0);
+}
+
+static void quadro_stale_work(struct work_struct *work)
+{
+	struct quadro_data *priv = container_of(to_delayed_work(work), struct quadro_data,
+						stale_work);
+
+	mutex_lock(&priv->lock);
+
+	if (!priv->stale) {
+		priv->stale = true;
+		quadro_log_event(priv, QUADRO_EVENT_STALE, 0, 0);
+	}
+
+	mutex_unlock(&priv->lock);
+}
+
+static void quadro_work(struct work_struct *work)
+{
+	struct quadro_data *priv = container_of(work, struct quadro_data, work);
+	u8 data[QUADRO_STATUS_DECODED_SIZE];
+	struct quadro_status status;
+	unsigned long updated;
+	u64 seq, start, timestamp, period;
+	bool rebooted;
+
+	spin_lock_irq(&priv->raw_lock);
+	memcpy(data, priv->raw_report, sizeof(data));
+	timestamp = priv->raw_timestamp;
+	period = priv->raw_period;
+	updated = priv->raw_jiffies;
+	seq = priv->raw_seq;
+	spin_unlock_irq(&priv->raw_lock);
+
+	mutex_lock(&priv->lock);
+
+	if (seq == priv->decoded_seq) {
+		mutex_unlock(&priv->lock);
+		return;
+	}
+
+	start = ktime_get_ns();
+
+	quadro_update_residency(priv, timestamp);
+	quadro_decode_status(&status, data);
+
+	rebooted = quadro_check_device(priv, &status);
+	if (rebooted)
+		quadro_handle_reboot(priv);
+
+	priv->status = status;
+	quadro_update_derived(priv);
+	quadro_update_stall(priv);
+	quadro_update_anomaly(priv);
+	priv->timestamp = timestamp;
+	priv->period = period;
+	priv->updated = updated;
+	priv->decoded_seq = seq;
+
+	if (priv->stale) {
+		priv->stale = false;
+		quadro_log_event(priv, QUADRO_EVENT_RECOVERED, 0, 0);
+	}
+
+	quadro_record_sample(priv);
+	quadro_iio_push(priv);
+
+	/* Cleared under the lock before the hwmon device goes away */
+	if (priv->hwmon_dev)
+		quadro_notify(priv);
+
+	quadro_timing_add(&priv->deferred_timing, ktime_get_ns() - start);
+
+	mutex_unlock(&priv->lock);
+
+	/* The control report may have been reset as well, read it again before use */
+	if (rebooted) {
+		mutex_lock(&priv->ctrl_lock);
+		priv->ctrl_valid = false;
+		mutex_unlock(&priv->ctrl_lock);
+	}
+
+	/* Reports stopped arriving if this fires before the next one was decoded */
+	mod_delayed_work(system_wq, &priv->stale_work, QUADRO_STATUS_UPDATE_INTERVAL);
+
+	wake_up_interruptible_all(&priv->sample_wait);
+	quadro_thermal_update(priv);
+}
+
+static void quadro_sw_work(struct work_struct *work)
+{
+	struct quadro_data *priv = container_of(to_delayed_work(work), struct quadro_data,
+						sw_work);
+	int i, ret;
+
+	mutex_lock(&priv->lock);
+
+	if (!priv->sw_dirty) {
+		mutex_unlock(&priv->lock);
+		return;
+	}
+
+	priv->sw_report[0] = QUADRO_SW_SENSOR_REPORT_ID;
+	for (i = 0; i < QUADRO_NUM_SW_SENSORS; i++)
+		put_unaligned_be16(priv->sw_sensor[i], priv->sw_report + 1 + i * 2);
+
+	priv->sw_dirty = false;
+
+	mutex_unlock(&priv->lock);
+
+	/* The buffer is only used here and the work item doesn't run concurrently */
+	mutex_lock(&priv->ctrl_lock);
+	ret = hid_hw_raw_request(priv->hdev, QUADRO_SW_SENSOR_REPORT_ID, priv->sw_report,
+				 QUADRO_SW_SENSOR_REPORT_SIZE, HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+	mutex_unlock(&priv->ctrl_lock);
+	if (ret < 0)
+		hid_warn(priv->hdev, "failed to send software sensors: %d\n", ret);
+}
+
+#if defined(CONFIG_DEBUG_FS) && IS_ENABLED(CONFIG_RELAY)
+
+static struct dentry *quadro_relay_create_buf_file(const char *filename, struct dentry *parent,
+						   umode_t mode, struct rchan_buf *buf,
+						   int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int quadro_relay_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+
+	return 0;
+}
+
+static const struct rchan_callbacks quadro_relay_callbacks = {
+	.create_buf_file = quadro_relay_create_buf_file,
+	.remove_buf_file = quadro_relay_remove_buf_file,
+};
+
+static void quadro_relay_init(struct quadro_data *priv)
+{
+	struct rchan *relay;
+
+	if (!raw_relay)
+		return;
+
+	relay = relay_open("raw", priv->debugfs, raw_relay_subbuf_size, raw_relay_subbufs,
+			   &quadro_relay_callbacks, NULL);
+	if (!relay) {
+		hid_warn(priv->hdev, "failed to open relay channel\n");
+		return;
+	}
+
+	spin_lock_irq(&priv->raw_lock);
+	priv->relay = relay;
+	spin_unlock_irq(&priv->raw_lock);
+}
+
+/* Called with priv->raw_lock held, which also disables interrupts as relay requires */
+static void quadro_relay_write(struct quadro_data *priv, const u8 *data, int size, u64 timestamp)
+{
+	struct quadro_raw_record *record;
+	int padded = ALIGN(size, 8);
+
+	if (!priv->relay)
+		return;
+
+	/* Padded, so the next record header is aligned as well */
+	record = relay_reserve(priv->relay, sizeof(*record) + padded);
+	if (!record) {
+		priv->relay_dropped++;
+		return;
+	}
+
+	record->timestamp_ns = timestamp;
+	record->size = size;
+	record->reserved = 0;
+	memcpy(record + 1, data, size);
+	memset((u8 *)(record + 1) + size, 0, padded - size);
+}
+
+/* Must run before the debugfs directory holding the relay files is removed */
+static void quadro_relay_remove(struct quadro_data *priv)
+{
+	struct rchan *relay;
+
+	spin_lock_irq(&priv->raw_lock);
+	relay = priv->relay;
+	priv->relay = NULL;
+	spin_unlock_irq(&priv->raw_lock);
+
+	if (relay)
+		relay_close(relay);
+}
+
+#else
+
+static void quadro_relay_init(struct quadro_data *priv)
+{
+}
+
+static void quadro_relay_write(struct quadro_data *priv, const u8 *data, int size, u64 timestamp)
+{
+}
+
+static void quadro_relay_remove(struct quadro_data *priv)
+{
+}
+
+#endif
+
+/* Called with priv->raw_lock held, before raw_timestamp is updated */
+static void quadro_update_period(struct quadro_data *priv, u64 timestamp)
+{
+	u64 delta = timestamp - priv->raw_timestamp;
+
+	/* Gaps in which the device stalled or was unplugged would skew the average */
+	if (!priv->raw_timestamp || delta > jiffies_to_nsecs(QUADRO_STATUS_UPDATE_INTERVAL))
+		return;
+
+	if (priv->raw_period)
+		priv->raw_period += ((s64)delta - (s64)priv->raw_period) >> QUADRO_PERIOD_SHIFT;
+	else
+		priv->raw_period = delta;
+}
+
+static int quadro_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+{
+	struct quadro_data *priv;
+	unsigned long flags;
+	u64 start;
+
+	if (report->id != QUADRO_STATUS_REPORT_ID)
+		return 0;
+
+	priv = hid_get_drvdata(hdev);
+
+	/* Only reports passing this are copied and decoded later, truncated ones are dropped */
+	if (size < priv->status_size || quadro_check_status(data, size))
+		return 0;
+
+	start = ktime_get_ns();
+
+	spin_lock_irqsave(&priv->raw_lock, flags);
+
+	memcpy(priv->raw_report, data, QUADRO_STATUS_DECODED_SIZE);
+	quadro_update_period(priv, start);
+	priv->raw_timestamp = start;
+	priv->raw_jiffies = jiffies;
+	priv->raw_seq++;
+
+	quadro_relay_write(priv, data, size, start);
+
+	/* Only the latest report is decoded if several arrive before the work runs */
+	if (!schedule_work(&priv->work))
+		priv->coalesced++;
+
+	quadro_timing_add(&priv->atomic_timing, ktime_get_ns() - start);
+
+	spin_unlock_irqrestore(&priv->raw_lock, flags);
+
+	return 0;
+}
+
+static ssize_t notify_interval_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", priv->notify_interval);
+}
+
+static ssize_t notify_interval_store(struct device *dev, struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&priv->lock);
+	priv->notify_interval = val;
+	priv->notify_count = 0;
+	mutex_unlock(&priv->lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(notify_interval);
+
+/* Time until the next report is expected, to schedule reads right after it arrives */
+static ssize_t next_sample_eta_ns_show(struct device *dev, struct device_attribute *attr,
+				       char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	s64 eta;
+
+	mutex_lock(&priv->lock);
+
+	if (!priv->period ||
+	    time_after(jiffies, priv->updated + QUADRO_STATUS_UPDATE_INTERVAL)) {
+		mutex_unlock(&priv->lock);
+		return -ENODATA;
+	}
+
+	eta = priv->timestamp + priv->period - ktime_get_ns();
+
+	mutex_unlock(&priv->lock);
+
+	/* An overdue report is due any moment */
+	return sysfs_emit(buf, "%lld\n", max_t(s64, eta, 0));
+}
+
+static DEVICE_ATTR_RO(next_sample_eta_ns);
+
+static ssize_t notify_delta_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n", priv->notify_delta[to_sensor_dev_attr(attr)->index]);
+}
+
+static ssize_t notify_delta_store(struct device *dev, struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int index = to_sensor_dev_attr(attr)->index;
+	long val;
+	int ret;
+
+	ret = kstrtol(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val < 0)
+		return -EINVAL;
+
+	mutex_lock(&priv->lock);
+	priv->notify_delta[index] = val;
+	mutex_unlock(&priv->lock);
+
+	return count;
+}
+
+/* Indexes match quadro_input_types, deltas are in the units of the respective inputs */
+static SENSOR_DEVICE_ATTR_RW(temp_notify_delta, notify_delta, 0);
+static SENSOR_DEVICE_ATTR_RW(fan_notify_delta, notify_delta, 1);
+static SENSOR_DEVICE_ATTR_RW(power_notify_delta, notify_delta, 2);
+static SENSOR_DEVICE_ATTR_RW(in_notify_delta, notify_delta, 3);
+static SENSOR_DEVICE_ATTR_RW(curr_notify_delta, notify_delta, 4);
+
+static ssize_t derived_coeffs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int index = to_sensor_dev_attr(attr)->index;
+	s32 *coeffs = priv->derived_coeffs[index];
+
+	return sysfs_emit(buf, "%d %d %d %d\n", coeffs[0], coeffs[1], coeffs[2], coeffs[3]);
+}
+
+/* Takes up to QUADRO_DERIVED_TERMS whitespace separated coefficients, missing ones are 0 */
+static ssize_t derived_coeffs_store(struct device *dev, struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int index = to_sensor_dev_attr(attr)->index;
+	s32 coeffs[QUADRO_DERIVED_TERMS] = {};
+	int i, n;
+
+	for (i = 0; i < QUADRO_DERIVED_TERMS; i++) {
+		buf = skip_spaces(buf);
+		if (!*buf)
+			break;
+
+		if (sscanf(buf, "%d%n", &coeffs[i], &n) != 1)
+			return -EINVAL;
+
+		if (abs(coeffs[i]) > QUADRO_DERIVED_COEFF_MAX)
+			return -EINVAL;
+
+		buf += n;
+	}
+
+	if (*skip_spaces(buf))
+		return -EINVAL;
+
+	mutex_lock(&priv->lock);
+	memcpy(priv->derived_coeffs[index], coeffs, sizeof(coeffs));
+	quadro_update_derived(priv);
+	mutex_unlock(&priv->lock);
+
+	return count;
+}
+
+/* Indexes match quadro_derived_channels */
+static SENSOR_DEVICE_ATTR_RW(temp5_coefficients, derived_coeffs, 0);
+static SENSOR_DEVICE_ATTR_RW(temp6_coefficients, derived_coeffs, 1);
+static SENSOR_DEVICE_ATTR_RW(power5_coefficients, derived_coeffs, 2);
+
+static ssize_t sw_sensor_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	s16 val = priv->sw_sensor[to_sensor_dev_attr(attr)->index];
+
+	if (val == QUADRO_SW_SENSOR_UNSET)
+		return -ENODATA;
+
+	return sysfs_emit(buf, "%d\n", val * 10);
+}
+
+/*
+ * Takes a temperature in millidegrees or "none". Writes are coalesced for
+ * sw_sensor_interval and sent to the device in a single report.
+ */
+static ssize_t sw_sensor_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int index = to_sensor_dev_attr(attr)->index;
+	long val;
+	int ret;
+
+	if (sysfs_streq(buf, "none")) {
+		val = QUADRO_SW_SENSOR_UNSET;
+	} else {
+		ret = kstrtol(buf, 0, &val);
+		if (ret)
+			return ret;
+
+		val = DIV_ROUND_CLOSEST(val, 10);
+		if (val < S16_MIN || val >= QUADRO_SW_SENSOR_UNSET)
+			return -EINVAL;
+	}
+
+	mutex_lock(&priv->lock);
+
+	if (priv->sw_sensor[index] != val) {
+		priv->sw_sensor[index] = val;
+		priv->sw_dirty = true;
+
+		/* Does nothing if a send is already pending, which then picks this up */
+		schedule_delayed_work(&priv->sw_work, msecs_to_jiffies(sw_sensor_interval));
+	}
+
+	mutex_unlock(&priv->lock);
+
+	return count;
+}
+
+static ssize_t pwm_auto_curve_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int i, ret, len = 0;
+	s16 temp;
+	u16 pwm;
+	u8 *fan;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	ret = quadro_ctrl_get(priv);
+	if (ret)
+		goto unlock;
+
+	fan = quadro_ctrl_fan(priv, to_sensor_dev_attr(attr)->index);
+
+	for (i = 0; i < QUADRO_CURVE_POINTS; i++) {
+		temp = get_unaligned_be16(fan + QUADRO_FAN_CTRL_CURVE_TEMP + i * 2);
+		pwm = get_unaligned_be16(fan + QUADRO_FAN_CTRL_CURVE_PWM + i * 2);
+
+		len += sysfs_emit_at(buf, len, "%d:%ld%c", temp * 10, quadro_percent_to_pwm(pwm),
+				     i == QUADRO_CURVE_POINTS - 1 ? '\n' : ' ');
+	}
+
+unlock:
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret ? ret : len;
+}
+
+/*
+ * Takes all QUADRO_CURVE_POINTS points as space separated temp:pwm pairs, temperatures
+ * in millidegrees and ascending, pwm from 0 to 255. The whole curve is uploaded in a
+ * single control report write.
+ */
+static ssize_t pwm_auto_curve_store(struct device *dev, struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	int offset = quadro_ctrl_fan_offsets[to_sensor_dev_attr(attr)->index];
+	s16 temps[QUADRO_CURVE_POINTS];
+	u16 pwms[QUADRO_CURVE_POINTS];
+	long temp, pwm;
+	int i, n, ret;
+
+	for (i = 0; i < QUADRO_CURVE_POINTS; i++) {
+		if (sscanf(buf, " %ld:%ld%n", &temp, &pwm, &n) != 2)
+			return -EINVAL;
+
+		temp = DIV_ROUND_CLOSEST(temp, 10);
+		if (temp < S16_MIN || temp > S16_MAX || pwm < 0 || pwm > 255)
+			return -EINVAL;
+
+		if (i && temp < temps[i - 1])
+			return -EINVAL;
+
+		temps[i] = temp;
+		pwms[i] = quadro_pwm_to_percent(pwm);
+		buf += n;
+	}
+
+	if (*skip_spaces(buf))
+		return -EINVAL;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	for (i = 0; i < QUADRO_CURVE_POINTS; i++) {
+		quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_CURVE_TEMP + i * 2, temps[i]);
+		quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_CURVE_PWM + i * 2, pwms[i]);
+	}
+
+	ret = quadro_ctrl_commit(priv);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret ? ret : count;
+}
+
+static ssize_t pwm_auto_temp_source_show(struct device *dev, struct device_attribute *attr,
+					 char *buf)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	u16 source;
+	int ret;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	ret = quadro_ctrl_get(priv);
+	if (!ret)
+		source = get_unaligned_be16(quadro_ctrl_fan(priv, to_sensor_dev_attr(attr)->index) +
+					    QUADRO_FAN_CTRL_TEMP_SELECT);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	if (ret)
+		return ret;
+
+	return sysfs_emit(buf, "%u\n", source + 1);
+}
+
+/* 1-4 select Temp1-4, 5-20 select software sensors 1-16 */
+static ssize_t pwm_auto_temp_source_store(struct device *dev, struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val < 1 || val > QUADRO_NUM_TEMP_SOURCES)
+		return -EINVAL;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	quadro_ctrl_set_be16(priv, quadro_ctrl_fan_offsets[to_sensor_dev_attr(attr)->index] +
+			     QUADRO_FAN_CTRL_TEMP_SELECT, val - 1);
+	ret = quadro_ctrl_commit(priv);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret ? ret : count;
+}
+
+/* Called with priv->ctrl_lock held and the shadow valid */
+static void quadro_profile_from_ctrl(struct quadro_data *priv, struct quadro_profile *profile)
+{
+	struct quadro_fan_profile *fan_profile;
+	int i, j;
+	u8 *fan;
+
+	memset(profile, 0, sizeof(*profile));
+	profile->magic = QUADRO_PROFILE_MAGIC;
+	profile->version = QUADRO_PROFILE_VERSION;
+	profile->size = sizeof(*profile);
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		fan = quadro_ctrl_fan(priv, i);
+		fan_profile = &profile->fans[i];
+
+		fan_profile->mode = fan[QUADRO_FAN_CTRL_MODE];
+		fan_profile->temp_source = get_unaligned_be16(fan + QUADRO_FAN_CTRL_TEMP_SELECT);
+		fan_profile->pwm = get_unaligned_be16(fan + QUADRO_FAN_CTRL_PWM);
+
+		for (j = 0; j < QUADRO_CURVE_POINTS; j++) {
+			fan_profile->curve_temp[j] =
+				get_unaligned_be16(fan + QUADRO_FAN_CTRL_CURVE_TEMP + j * 2);
+			fan_profile->curve_pwm[j] =
+				get_unaligned_be16(fan + QUADRO_FAN_CTRL_CURVE_PWM + j * 2);
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(profile->temp_offset); i++)
+		profile->temp_offset[i] =
+			get_unaligned_be16(priv->ctrl_shadow + QUADRO_CTRL_TEMP_OFFSETS + i * 2);
+
+	profile->flow_pulses = get_unaligned_be16(priv->ctrl_shadow + QUADRO_CTRL_FLOW_PULSES);
+}
+
+/* Called with priv->ctrl_lock held */
+static void quadro_profile_to_ctrl(struct quadro_data *priv, const struct quadro_profile *profile)
+{
+	const struct quadro_fan_profile *fan_profile;
+	int i, j, offset;
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		offset = quadro_ctrl_fan_offsets[i];
+		fan_profile = &profile->fans[i];
+
+		quadro_ctrl_set_u8(priv, offset + QUADRO_FAN_CTRL_MODE, fan_profile->mode);
+		quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_TEMP_SELECT,
+				     fan_profile->temp_source);
+		quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_PWM, fan_profile->pwm);
+
+		for (j = 0; j < QUADRO_CURVE_POINTS; j++) {
+			quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_CURVE_TEMP + j * 2,
+					     fan_profile->curve_temp[j]);
+			quadro_ctrl_set_be16(priv, offset + QUADRO_FAN_CTRL_CURVE_PWM + j * 2,
+					     fan_profile->curve_pwm[j]);
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(profile->temp_offset); i++)
+		quadro_ctrl_set_be16(priv, QUADRO_CTRL_TEMP_OFFSETS + i * 2, profile->temp_offset[i]);
+
+	quadro_ctrl_set_be16(priv, QUADRO_CTRL_FLOW_PULSES, profile->flow_pulses);
+}
+
+static int quadro_profile_validate(const struct quadro_profile *profile)
+{
+	const struct quadro_fan_profile *fan_profile;
+	int i, j;
+
+	if (profile->magic != QUADRO_PROFILE_MAGIC || profile->version != QUADRO_PROFILE_VERSION ||
+	    profile->size != sizeof(*profile) || profile->reserved)
+		return -EINVAL;
+
+	/* The flow rate is derived from it, a sensor can't have 0 pulses per liter */
+	if (!profile->flow_pulses)
+		return -EINVAL;
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		fan_profile = &profile->fans[i];
+
+		if (fan_profile->mode > QUADRO_FAN_MODE_FOLLOW ||
+		    fan_profile->temp_source >= QUADRO_NUM_TEMP_SOURCES ||
+		    fan_profile->pwm > 100 * 100)
+			return -EINVAL;
+
+		for (j = 0; j < QUADRO_CURVE_POINTS; j++) {
+			if (fan_profile->curve_pwm[j] > 100 * 100)
+				return -EINVAL;
+
+			if (j && fan_profile->curve_temp[j] < fan_profile->curve_temp[j - 1])
+				return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static ssize_t profile_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+			    char *buf, loff_t off, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(kobj_to_dev(kobj));
+	struct quadro_profile profile;
+	int ret;
+
+	/* Reads at the end must not cost a control report transfer */
+	if (off >= sizeof(profile))
+		return 0;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	ret = quadro_ctrl_get(priv);
+	if (!ret)
+		quadro_profile_from_ctrl(priv, &profile);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	if (ret)
+		return ret;
+
+	count = min_t(size_t, count, sizeof(profile) - off);
+	memcpy(buf, (u8 *)&profile + off, count);
+
+	return count;
+}
+
+/*
+ * Takes a complete struct quadro_profile in a single write, validates it and applies
+ * it with one control report write.
+ */
+static ssize_t profile_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+			     char *buf, loff_t off, size_t count)
+{
+	struct quadro_data *priv = dev_get_drvdata(kobj_to_dev(kobj));
+	struct quadro_profile profile;
+	int ret;
+
+	if (off || count != sizeof(profile))
+		return -EINVAL;
+
+	memcpy(&profile, buf, sizeof(profile));
+
+	ret = quadro_profile_validate(&profile);
+	if (ret)
+		return ret;
+
+	mutex_lock(&priv->ctrl_lock);
+
+	quadro_profile_to_ctrl(priv, &profile);
+	ret = quadro_ctrl_commit(priv);
+
+	mutex_unlock(&priv->ctrl_lock);
+
+	return ret ? ret : count;
+}
+static BIN_ATTR_RW(profile, sizeof(struct quadro_profile));
+
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_curve, pwm_auto_curve, 0);
+static SENSOR_DEVICE_ATTR_RW(pwm2_auto_curve, pwm_auto_curve, 1);
+static SENSOR_DEVICE_ATTR_RW(pwm3_auto_curve, pwm_auto_curve, 2);
+static SENSOR_DEVICE_ATTR_RW(pwm4_auto_curve, pwm_auto_curve, 3);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_temp_source, pwm_auto_temp_source, 0);
+static SENSOR_DEVICE_ATTR_RW(pwm2_auto_temp_source, pwm_auto_temp_source, 1);
+static SENSOR_DEVICE_ATTR_RW(pwm3_auto_temp_source, pwm_auto_temp_source, 2);
+static SENSOR_DEVICE_ATTR_RW(pwm4_auto_temp_source, pwm_auto_temp_source, 3);
+
+static SENSOR_DEVICE_ATTR_RW(sw_sensor1, sw_sensor, 0);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor2, sw_sensor, 1);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor3, sw_sensor, 2);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor4, sw_sensor, 3);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor5, sw_sensor, 4);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor6, sw_sensor, 5);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor7, sw_sensor, 6);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor8, sw_sensor, 7);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor9, sw_sensor, 8);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor10, sw_sensor, 9);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor11, sw_sensor, 10);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor12, sw_sensor, 11);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor13, sw_sensor, 12);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor14, sw_sensor, 13);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor15, sw_sensor, 14);
+static SENSOR_DEVICE_ATTR_RW(sw_sensor16, sw_sensor, 15);
+
+static struct attribute *quadro_attrs[] = {
+	&sensor_dev_attr_temp5_coefficients.dev_attr.attr,
+	&sensor_dev_attr_temp6_coefficients.dev_attr.attr,
+	&sensor_dev_attr_power5_coefficients.dev_attr.attr,
+	&dev_attr_notify_interval.attr,
+	&dev_attr_next_sample_eta_ns.attr,
+	&sensor_dev_attr_temp_notify_delta.dev_attr.attr,
+	&sensor_dev_attr_fan_notify_delta.dev_attr.attr,
+	&sensor_dev_attr_power_notify_delta.dev_attr.attr,
+	&sensor_dev_attr_in_notify_delta.dev_attr.attr,
+	&sensor_dev_attr_curr_notify_delta.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm2_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm3_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm4_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_temp_source.dev_attr.attr,
+	&sensor_dev_attr_pwm2_auto_temp_source.dev_attr.attr,
+	&sensor_dev_attr_pwm3_auto_temp_source.dev_attr.attr,
+	&sensor_dev_attr_pwm4_auto_temp_source.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor1.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor2.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor3.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor4.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor5.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor6.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor7.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor8.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor9.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor10.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor11.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor12.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor13.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor14.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor15.dev_attr.attr,
+	&sensor_dev_attr_sw_sensor16.dev_attr.attr,
+	NULL
+};
+static struct bin_attribute *quadro_bin_attrs[] = {
+	&bin_attr_profile,
+	NULL
+};
+
+static const struct attribute_group quadro_group = {
+	.attrs = quadro_attrs,
+	.bin_attrs = quadro_bin_attrs,
+};
+__ATTRIBUTE_GROUPS(quadro);
+
+#ifdef CONFIG_DEBUG_FS
+
+static int serial_number_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+
+	seq_printf(seqf, "%05u-%05u\n", priv->status.serial_number[0], priv->status.serial_number[1]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(serial_number);
+
+static int firmware_version_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+
+	seq_printf(seqf, "%u\n", priv->status.firmware_version);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(firmware_version);
+
+static int power_cycles_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+
+	seq_printf(seqf, "%u\n", priv->status.power_cycles);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(power_cycles);
+
+static void quadro_timing_show(struct seq_file *seqf, const char *name,
+			       const struct quadro_timing *timing)
+{
+	seq_printf(seqf, "%s: count %llu avg %llu ns max %llu ns\n", name, timing->count,
+		   timing->count ? div64_u64(timing->total_ns, timing->count) : 0, timing->max_ns);
+}
+
+/*
+ * Time spent per report in atomic context (copy and handoff) and in the work item
+ * (decoding, which used to run in atomic context as well).
+ */
+static int timing_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+	struct quadro_timing atomic_timing;
+	u64 coalesced, relay_dropped;
+
+	spin_lock_irq(&priv->raw_lock);
+	atomic_timing = priv->atomic_timing;
+	coalesced = priv->coalesced;
+	relay_dropped = priv->relay_dropped;
+	spin_unlock_irq(&priv->raw_lock);
+
+	quadro_timing_show(seqf, "atomic", &atomic_timing);
+
+	mutex_lock(&priv->lock);
+	quadro_timing_show(seqf, "deferred", &priv->deferred_timing);
+	mutex_unlock(&priv->lock);
+
+	seq_printf(seqf, "coalesced: %llu\n", coalesced);
+	seq_printf(seqf, "relay_dropped: %llu\n", relay_dropped);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(timing);
+
+static int ctrl_stats_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+
+	mutex_lock(&priv->ctrl_lock);
+	seq_printf(seqf, "reads: %llu\n", priv->ctrl_reads);
+	seq_printf(seqf, "writes: %llu\n", priv->ctrl_writes);
+	seq_printf(seqf, "cache hits: %llu\n", priv->ctrl_cache_hits);
+	seq_printf(seqf, "conflicts: %llu\n", priv->ctrl_conflicts);
+	mutex_unlock(&priv->ctrl_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ctrl_stats);
+
+static void quadro_residency_show(struct seq_file *seqf, const char *name, int fan,
+				  const u64 *residency, int buckets)
+{
+	int i;
+
+	seq_printf(seqf, "fan%d_%s_ms:", fan + 1, name);
+	for (i = 0; i < buckets; i++)
+		seq_printf(seqf, " %llu", div_u64(residency[i], NSEC_PER_MSEC));
+	seq_putc(seqf, '\n');
+}
+
+static int residency_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+	int i;
+
+	seq_printf(seqf, "rpm_bucket_width: %d\n", QUADRO_RPM_BUCKET_WIDTH);
+	seq_printf(seqf, "duty_bucket_width: %d%%\n", QUADRO_DUTY_BUCKET_WIDTH / 100);
+
+	mutex_lock(&priv->lock);
+
+	for (i = 0; i < QUADRO_NUM_FANS; i++) {
+		quadro_residency_show(seqf, "rpm", i, priv->rpm_residency[i], QUADRO_RPM_BUCKETS);
+		quadro_residency_show(seqf, "duty", i, priv->duty_residency[i],
+				      QUADRO_DUTY_BUCKETS);
+	}
+
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(residency);
+
+static int anomalies_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+	int i;
+
+	mutex_lock(&priv->lock);
+
+	for (i = 0; i < QUADRO_ANOMALY_CHANNELS; i++)
+		seq_printf(seqf, "%s: %llu\n",
+			   i == QUADRO_ANOMALY_FLOW ? label_speeds[0] : label_temps[i],
+			   priv->ewma[i].anomalies);
+
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(anomalies);
+
+static int events_show(struct seq_file *seqf, void *unused)
+{
+	struct quadro_data *priv = seqf->private;
+	const struct quadro_event *event;
+	u64 i, first, secs;
+	u32 rem;
+
+	mutex_lock(&priv->lock);
+
+	first = priv->event_count > QUADRO_EVENT_LOG_LEN ?
+		priv->event_count - QUADRO_EVENT_LOG_LEN : 0;
+
+	for (i = first; i < priv->event_count; i++) {
+		event = &priv->events[i % QUADRO_EVENT_LOG_LEN];
+		secs = div_u64_rem(event->timestamp, NSEC_PER_SEC, &rem);
+		rem /= NSEC_PER_USEC;
+
+		seq_printf(seqf, "[%llu.%06u] %s channel %d value %ld\n", secs, rem,
+			   quadro_event_names[event->type], event->channel, event->value);
+	}
+
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(events);
+
+static void quadro_debugfs_init(struct quadro_data *priv)
+{
+	char name[32];
+
+	scnprintf(name, sizeof(name), "%s-%s", DRIVER_NAME, dev_name(&priv->hdev->dev));
+
+	priv->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("serial_number", 0444, priv->debugfs, priv, &serial_number_fops);
+	debugfs_create_file("firmware_version", 0444, priv->debugfs, priv, &firmware_version_fops);
+	debugfs_create_file("power_cycles", 0444, priv->debugfs, priv, &power_cycles_fops);
+	debugfs_create_file("timing", 0444, priv->debugfs, priv, &timing_fops);
+	debugfs_create_file("ctrl_stats", 0444, priv->debugfs, priv, &ctrl_stats_fops);
+	debugfs_create_file("residency", 0444, priv->debugfs, priv, &residency_fops);
+	debugfs_create_file("anomalies", 0444, priv->debugfs, priv, &anomalies_fops);
+	debugfs_create_file("events", 0444, priv->debugfs, priv, &events_fops);
+
+	quadro_relay_init(priv);
+}
+
+#else
+
+static void quadro_debugfs_init(struct quadro_data *priv)
+{
+}
+
+#endif
+
+static DEFINE_IDA(quadro_ida);
+
+static void quadro_release(struct kref *kref)
+{
+	struct quadro_data *priv = container_of(kref, struct quadro_data, kref);
+
+	kfree(priv->history);
+	kfree(priv);
+}
+
+/* State of an open /dev/quadroN, protected by priv->lock */
+struct quadro_file {
+	struct quadro_data *priv;
+	u32 mask;
+	u64 next_seq;
+	bool schema_pending;
+};
+
+/* Channels of the stream, in the order of the mask bits */
+static const struct {
+	const char *const *labels;
+	const char *unit;
+	u32 scale_den;
+	int channels;
+} quadro_stream_types[] = {
+	{ label_temps, "degC", 1000, 4 },
+	{ label_speeds, "rpm", 1, 5 },
+	{ label_power, "W", 1000000, 4 },
+	{ label_voltages, "V", 1000, 5 },
+	{ label_current, "A", 1000, 4 },
+};
+
+#define QUADRO_STREAM_FLOW_BIT		4
+
+static int quadro_chardev_open(struct inode *inode, struct file *filp)
+{
+	struct quadro_data *priv = container_of(filp->private_data, struct quadro_data, misc);
+	struct quadro_file *qf;
+
+	qf = kzalloc(sizeof(*qf), GFP_KERNEL);
+	if (!qf)
+		return -ENOMEM;
+
+	/* Called under the misc device lock, so the device can't be removed meanwhile */
+	kref_get(&priv->kref);
+	qf->priv = priv;
+	qf->mask = QUADRO_CHAN_ALL;
+	qf->schema_pending = true;
+
+	/* Readers start with the next sample */
+	mutex_lock(&priv->lock);
+	qf->next_seq = priv->sample_seq + 1;
+	mutex_unlock(&priv->lock);
+
+	filp->private_data = qf;
+
+	return nonseekable_open(inode, filp);
+}
+
+static int quadro_chardev_release(struct inode *inode, struct file *filp)
+{
+	struct quadro_file *qf = filp->private_data;
+
+	kref_put(&qf->priv->kref, quadro_release);
+	kfree(qf);
+
+	return 0;
+}
+
+static size_t quadro_record_size(u32 mask)
+{
+	return sizeof(struct quadro_record) + hweight32(mask) * sizeof(s32);
+}
+
+/*
+ * Called with priv->lock held, writes the record to buf and returns its size. Records
+ * are packed back to back, so they are only 4 byte aligned.
+ */
+static size_t quadro_pack_record(const struct quadro_sample *sample, u32 mask, u8 *buf)
+{
+	struct quadro_record *record = (struct quadro_record *)buf;
+	s32 values[QUADRO_NUM_CHANNELS];
+	int i, n = 0;
+
+	quadro_sample_values(sample, values);
+
+	put_unaligned(sample->seq, &record->seq);
+	put_unaligned(sample->timestamp_ns, &record->timestamp_ns);
+
+	for (i = 0; i < QUADRO_NUM_CHANNELS; i++)
+		if (mask & BIT(i))
+			put_unaligned(values[i], &record->values[n++]);
+
+	return quadro_record_size(mask);
+}
+
+static size_t quadro_schema_size(u32 mask)
+{
+	return sizeof(struct quadro_schema) + hweight32(mask) * sizeof(struct quadro_channel_desc);
+}
+
+/* Fills the zeroed buf with the schema of records holding the channels in mask */
+static void quadro_build_schema(u32 mask, struct quadro_schema *schema)
+{
+	struct quadro_channel_desc *desc = schema->channels;
+	int i, j, bit = 0;
+
+	schema->magic = QUADRO_SCHEMA_MAGIC;
+	schema->version = QUADRO_SCHEMA_VERSION;
+	schema->size = quadro_schema_size(mask);
+	schema->record_size = quadro_record_size(mask);
+	schema->num_channels = hweight32(mask);
+	schema->mask = mask;
+
+	for (i = 0; i < ARRAY_SIZE(quadro_stream_types); i++) {
+		for (j = 0; j < quadro_stream_types[i].channels; j++, bit++) {
+			if (!(mask & BIT(bit)))
+				continue;
+
+			strscpy(desc->name, quadro_stream_types[i].labels[j], sizeof(desc->name));
+			strscpy(desc->unit, bit == QUADRO_STREAM_FLOW_BIT ? "l/h" :
+				quadro_stream_types[i].unit, sizeof(desc->unit));
+			desc->scale_den = quadro_stream_types[i].scale_den;
+			desc->offset = sizeof(struct quadro_record) +
+				       (desc - schema->channels) * sizeof(s32);
+			desc->bit = bit;
+			desc++;
+		}
+	}
+}
+
+/* Called with priv->lock held, which it releases */
+static ssize_t quadro_read_schema(struct quadro_file *qf, char __user *buf, size_t count)
+{
+	struct quadro_schema *schema;
+	size_t size;
+	ssize_t ret;
+
+	size = quadro_schema_size(qf->mask);
+	if (count < size) {
+		mutex_unlock(&qf->priv->lock);
+		return -EINVAL;
+	}
+
+	schema = kzalloc(size, GFP_KERNEL);
+	if (!schema) {
+		mutex_unlock(&qf->priv->lock);
+		return -ENOMEM;
+	}
+
+	quadro_build_schema(qf->mask, schema);
+	qf->schema_pending = false;
+
+	mutex_unlock(&qf->priv->lock);
+
+	ret = copy_to_user(buf, schema, size) ? -EFAULT : size;
+	kfree(schema);
+
+	return ret;
+}
+
+static ssize_t quadro_chardev_read(struct file *filp, char __user *buf, size_t count,
+				   loff_t *ppos)
+{
+	struct quadro_file *qf = filp->private_data;
+	struct quadro_data *priv = qf->priv;
+	size_t record_size, len = 0;
+	u64 seq, oldest;
+	u8 *records;
+	int ret;
+
+	mutex_lock(&priv->lock);
+
+	if (qf->schema_pending)
+		return quadro_read_schema(qf, buf, count);
+
+	while (priv->sample_seq < qf->next_seq && !priv->removed) {
+		mutex_unlock(&priv->lock);
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(priv->sample_wait,
+					       READ_ONCE(priv->sample_seq) >= READ_ONCE(qf->next_seq) ||
+					       READ_ONCE(priv->removed));
+		if (ret)
+			return ret;
+
+		mutex_lock(&priv->lock);
+	}
+
+	if (priv->removed) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	record_size = quadro_record_size(qf->mask);
+	count = min_t(size_t, count / record_size, QUADRO_HISTORY_LEN);
+	if (!count) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	records = kmalloc_array(count, record_size, GFP_KERNEL);
+	if (!records) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	/* Readers that fell behind skip the samples that already left the history */
+	oldest = priv->sample_seq > QUADRO_HISTORY_LEN ?
+		 priv->sample_seq - QUADRO_HISTORY_LEN + 1 : 1;
+
+	for (seq = max(qf->next_seq, oldest); seq <= priv->sample_seq && count; seq++, count--)
+		len += quadro_pack_record(&priv->history[seq % QUADRO_HISTORY_LEN], qf->mask,
+					  records + len);
+
+	qf->next_seq = seq;
+
+	mutex_unlock(&priv->lock);
+
+	ret = copy_to_user(buf, records, len) ? -EFAULT : len;
+	kfree(records);
+
+	return ret;
+
+unlock:
+	mutex_unlock(&priv->lock);
+	return ret;
+}
+
+static __poll_t quadro_chardev_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct quadro_file *qf = filp->private_data;
+	struct quadro_data *priv = qf->priv;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &priv->sample_wait, wait);
+
+	mutex_lock(&priv->lock);
+
+	if (priv->removed)
+		mask = EPOLLHUP | EPOLLERR;
+	else if (qf->schema_pending || priv->sample_seq >= qf->next_seq)
+		mask = EPOLLIN | EPOLLRDNORM;
+
+	mutex_unlock(&priv->lock);
+
+	return mask;
+}
+
+static long quadro_ioctl_set_mask(struct quadro_file *qf, u32 __user *argp)
+{
+	u32 mask;
+
+	if (get_user(mask, argp))
+		return -EFAULT;
+
+	if (!mask || mask & ~QUADRO_CHAN_ALL)
+		return -EINVAL;
+
+	mutex_lock(&qf->priv->lock);
+	qf->mask = mask;
+	qf->schema_pending = true;
+	mutex_unlock(&qf->priv->lock);
+
+	return 0;
+}
+
+static int quadro_get_snapshot(struct quadro_data *priv, struct quadro_sample *sample)
+{
+	int ret = 0;
+
+	mutex_lock(&priv->lock);
+
+	if (priv->sample_seq)
+		*sample = priv->history[priv->sample_seq % QUADRO_HISTORY_LEN];
+	else
+		ret = -ENODATA;
+
+	mutex_unlock(&priv->lock);
+
+	return ret;
+}
+
+static long quadro_ioctl_get_history(struct quadro_data *priv, void __user *argp)
+{
+	struct quadro_sample *samples;
+	struct quadro_history req;
+	u64 seq, oldest;
+	u32 count = 0;
+	int ret = 0;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+
+	if (req.reserved)
+		return -EINVAL;
+
+	req.count = min_t(u32, req.count, QUADRO_HISTORY_LEN);
+
+	samples = kcalloc(req.count, sizeof(*samples), GFP_KERNEL);
+	if (req.count && !samples)
+		return -ENOMEM;
+
+	mutex_lock(&priv->lock);
+
+	oldest = priv->sample_seq > QUADRO_HISTORY_LEN ?
+		 priv->sample_seq - QUADRO_HISTORY_LEN + 1 : 1;
+
+	for (seq = max(req.since_seq + 1, oldest); seq <= priv->sample_seq && count < req.count;
+	     seq++)
+		samples[count++] = priv->history[seq % QUADRO_HISTORY_LEN];
+
+	mutex_unlock(&priv->lock);
+
+	if (count && copy_to_user(u64_to_user_ptr(req.samples), samples,
+				  count * sizeof(*samples)))
+		ret = -EFAULT;
+
+	kfree(samples);
+
+	if (ret)
 		return ret;
 
-	ret = hid_hw_start(hdev, HID_CONNECT_HIDRAW);
+	req.count = count;
+	if (copy_to_user(argp, &req, sizeof(req)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long quadro_ioctl_wait_next(struct quadro_data *priv, void __user *argp)
+{
+	struct quadro_wait req;
+	long timeout;
+	int ret;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+
+	if (req.reserved)
+		return -EINVAL;
+
+	timeout = req.timeout_ms ? msecs_to_jiffies(req.timeout_ms) : MAX_SCHEDULE_TIMEOUT;
+
+	timeout = wait_event_interruptible_timeout(priv->sample_wait,
+						   READ_ONCE(priv->sample_seq) > req.seq ||
+						   READ_ONCE(priv->removed), timeout);
+	if (timeout < 0)
+		return timeout;
+	if (READ_ONCE(priv->removed))
+		return -ENODEV;
+	if (!timeout)
+		return -ETIMEDOUT;
+
+	ret = quadro_get_snapshot(priv, &req.sample);
 	if (ret)
 		return ret;
 
+	if (copy_to_user(argp, &req, sizeof(req)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long quadro_chardev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct quadro_file *qf = filp->private_data;
+	struct quadro_data *priv = qf->priv;
+	void __user *argp = (void __user *)arg;
+	struct quadro_sample sample;
+	int ret;
+
+	switch (cmd) {
+	case QUADRO_IOC_GET_SNAPSHOT:
+		ret = quadro_get_snapshot(priv, &sample);
+		if (ret)
+			return ret;
+
+		return copy_to_user(argp, &sample, sizeof(sample)) ? -EFAULT : 0;
+	case QUADRO_IOC_GET_HISTORY:
+		return quadro_ioctl_get_history(priv, argp);
+	case QUADRO_IOC_WAIT_NEXT:
+		return quadro_ioctl_wait_next(priv, argp);
+	case QUADRO_IOC_SET_MASK:
+		return quadro_ioctl_set_mask(qf, argp);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations quadro_chardev_fops = {
+	.owner = THIS_MODULE,
+	.open = quadro_chardev_open,
+	.release = quadro_chardev_release,
+	.read = quadro_chardev_read,
+	.poll = quadro_chardev_poll,
+	.unlocked_ioctl = quadro_chardev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = no_llseek,
+};
+
+/* Like debugfs, the character device is optional and failure only loses it */
+static void quadro_chardev_init(struct quadro_data *priv)
+{
+	int ret;
+
+	priv->misc_id = ida_alloc(&quadro_ida, GFP_KERNEL);
+	if (priv->misc_id < 0) {
+		hid_warn(priv->hdev, "failed to allocate character device id: %d\n",
+			 priv->misc_id);
+		return;
+	}
+
+	scnprintf(priv->misc_name, sizeof(priv->misc_name), "quadro%d", priv->misc_id);
+
+	priv->misc.minor = MISC_DYNAMIC_MINOR;
+	priv->misc.name = priv->misc_name;
+	priv->misc.fops = &quadro_chardev_fops;
+	priv->misc.parent = &priv->hdev->dev;
+	priv->misc.mode = 0444;
+
+	ret = misc_register(&priv->misc);
+	if (ret) {
+		hid_warn(priv->hdev, "failed to register %s: %d\n", priv->misc_name, ret);
+		ida_free(&quadro_ida, priv->misc_id);
+		priv->misc_id = -1;
+	}
+}
+
+static void quadro_chardev_remove(struct quadro_data *priv)
+{
+	if (priv->misc_id >= 0) {
+		misc_deregister(&priv->misc);
+		ida_free(&quadro_ida, priv->misc_id);
+	}
+
+	/* Wake up blocked readers, open handles keep priv alive until they are closed */
+	mutex_lock(&priv->lock);
+	priv->removed = true;
+	mutex_unlock(&priv->lock);
+
+	wake_up_interruptible_all(&priv->sample_wait);
+}
+
+/* Length of the status report from the report descriptor, which must cover all readings */
+static int quadro_status_size(struct hid_device *hdev)
+{
+	struct hid_report *report;
+	int size;
+
+	report = hdev->report_enum[HID_INPUT_REPORT].report_id_hash[QUADRO_STATUS_REPORT_ID];
+	if (!report) {
+		hid_err(hdev, "no status report in the report descriptor\n");
+		return -ENODEV;
+	}
+
+	size = hid_report_len(report);
+	if (size < QUADRO_STATUS_DECODED_SIZE) {
+		hid_err(hdev, "status report of %d bytes is too short\n", size);
+		return -ENODEV;
+	}
+
+	return size;
+}
+
+static int quadro_probe(struct hid_device *hdev, const struct hid_device_id *id)
+{
+	struct quadro_data *priv;
+	struct device *hwmon_dev;
+	int i, ret;
+
+	/* Not devm managed, open handles of the character device may outlive the device */
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	kref_init(&priv->kref);
+	priv->misc_id = -1;
+
+	priv->history = kcalloc(QUADRO_HISTORY_LEN, sizeof(*priv->history), GFP_KERNEL);
+	if (!priv->history) {
+		ret = -ENOMEM;
+		goto fail_and_free;
+	}
+
+	/* Transfer buffers are only used while the device is bound */
+	priv->sw_report = devm_kzalloc(&hdev->dev, QUADRO_SW_SENSOR_REPORT_SIZE, GFP_KERNEL);
+	priv->ctrl_report = devm_kzalloc(&hdev->dev, QUADRO_CTRL_REPORT_SIZE, GFP_KERNEL);
+	priv->secondary_ctrl_report = devm_kzalloc(&hdev->dev, QUADRO_SECONDARY_CTRL_REPORT_SIZE,
+						   GFP_KERNEL);
+	if (!priv->sw_report || !priv->ctrl_report || !priv->secondary_ctrl_report) {
+		ret = -ENOMEM;
+		goto fail_and_free;
+	}
+
+	priv->hdev = hdev;
+	hid_set_drvdata(hdev, priv);
+
+	spin_lock_init(&priv->raw_lock);
+	mutex_init(&priv->lock);
+	mutex_init(&priv->ctrl_lock);
+	INIT_WORK(&priv->work, quadro_work);
+	INIT_DELAYED_WORK(&priv->sw_work, quadro_sw_work);
+	INIT_DELAYED_WORK(&priv->stale_work, quadro_stale_work);
+	init_waitqueue_head(&priv->sample_wait);
+
+	for (i = 0; i < QUADRO_NUM_SW_SENSORS; i++)
+		priv->sw_sensor[i] = QUADRO_SW_SENSOR_UNSET;
+
+	priv->updated = jiffies - QUADRO_STATUS_UPDATE_INTERVAL;
+
+	ret = hid_parse(hdev);
+	if (ret)
+		goto fail_and_free;
+
+	ret = quadro_status_size(hdev);
+	if (ret < 0)
+		goto fail_and_free;
+
+	priv->status_size = ret;
+
+	ret = hid_hw_start(hdev, HID_CONNECT_HIDRAW);
+	if (ret)
+		goto fail_and_free;
+
 	ret = hid_hw_open(hdev);
 	if (ret)
 		goto fail_and_stop;
 
-	priv->hwmon_dev = hwmon_device_register_with_info(&hdev->dev, "quadro", priv,
-							  &quadro_chip_info, NULL);
+	hwmon_dev = hwmon_device_register_with_info(&hdev->dev, "quadro", priv, &quadro_chip_info,
+						    quadro_groups);
 
-	if (IS_ERR(priv->hwmon_dev)) {
-		ret = PTR_ERR(priv->hwmon_dev);
+	if (IS_ERR(hwmon_dev)) {
+		ret = PTR_ERR(hwmon_dev);
 		goto fail_and_close;
 	}
 
+	/* Reports are already being decoded, which must never see an error pointer */
+	mutex_lock(&priv->lock);
+	priv->hwmon_dev = hwmon_dev;
+	mutex_unlock(&priv->lock);
+
 	quadro_debugfs_init(priv);
+	quadro_chardev_init(priv);
+	quadro_iio_init(priv);
+	quadro_cooling_init(priv);
+	quadro_thermal_init(priv);
 
 	return 0;
 
@@ -370,18 +3126,42 @@ fail_and_close:
 	hid_hw_close(hdev);
 fail_and_stop:
 	hid_hw_stop(hdev);
+	cancel_work_sync(&priv->work);
+	cancel_delayed_work_sync(&priv->stale_work);
+fail_and_free:
+	kref_put(&priv->kref, quadro_release);
 	return ret;
 }
 
 static void quadro_remove(struct hid_device *hdev)
 {
 	struct quadro_data *priv = hid_get_drvdata(hdev);
+	struct device *hwmon_dev;
 
+	quadro_relay_remove(priv);
 	debugfs_remove_recursive(priv->debugfs);
-	hwmon_device_unregister(priv->hwmon_dev);
+	quadro_chardev_remove(priv);
+
+	mutex_lock(&priv->lock);
+	hwmon_dev = priv->hwmon_dev;
+	priv->hwmon_dev = NULL;
+	mutex_unlock(&priv->lock);
+
+	/* Once the attributes are gone nothing can queue another software sensor send */
+	hwmon_device_unregister(hwmon_dev);
+	cancel_delayed_work_sync(&priv->sw_work);
+	quadro_cooling_remove(priv);
 
 	hid_hw_close(hdev);
 	hid_hw_stop(hdev);
+
+	/* No more reports can arrive, so the work items can't be requeued */
+	cancel_work_sync(&priv->work);
+	cancel_delayed_work_sync(&priv->stale_work);
+	quadro_iio_remove(priv);
+	quadro_thermal_remove(priv);
+
+	kref_put(&priv->kref, quadro_release);
 }
 
 static const struct hid_device_id quadro_table[] = {
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Userspace interface of the Aquacomputer Quadro hwmon driver
+ *
+ * Copyright 2021 Leonard Anderweit <leonard.anderweit@gmail.com>
+ */
+
+#ifndef _AQUACOMPUTER_QUADRO_H
+#define _AQUACOMPUTER_QUADRO_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define QUADRO_PROFILE_MAGIC		0x46525051 /* "QPRF" */
+#define QUADRO_PROFILE_VERSION		1
+
+/*
+ * Complete control configuration, read from and written to the "profile" binary
+ * attribute of the hwmon device in one piece. Values are in host byte order and in
+ * the device's units: centidegrees and centipercent.
+ */
+struct quadro_fan_profile {
+	__u8 mode;		/* 0 = manual, 1 = PID, 2 = curve, 3 = follow fan */
+	__u8 temp_source;	/* 0-3 = Temp1-4, 4-19 = software sensors 1-16 */
+	__u16 pwm;		/* Duty in manual mode */
+	__s16 curve_temp[16];	/* Ascending */
+	__u16 curve_pwm[16];
+};
+
+struct quadro_profile {
+	__u32 magic;		/* QUADRO_PROFILE_MAGIC */
+	__u16 version;		/* QUADRO_PROFILE_VERSION */
+	__u16 size;		/* sizeof(struct quadro_profile) */
+	struct quadro_fan_profile fans[4];
+	__s16 temp_offset[4];	/* Calibration of Temp1-4 */
+	__u16 flow_pulses;	/* Flow sensor pulses per liter */
+	__u16 reserved;		/* Must be 0 */
+};
+
+/*
+ * A decoded status report as returned by the ioctls of /dev/quadroN. Values are in
+ * hwmon units: millidegrees, RPM (l/h for the flow sensor), microwatts, millivolts and
+ * milliamperes.
+ */
+struct quadro_sample {
+	__u64 seq;		/* Counts decoded reports, starts at 1 */
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC arrival time of the report */
+	__u64 next_timestamp_ns; /* Predicted arrival of the next report, 0 if unknown */
+	__s32 temp[4];		/* Temp1-4 */
+	__u32 speed[5];		/* Flow, Fan1-4 */
+	__u32 power[4];		/* Fan1-4 */
+	__u32 voltage[5];	/* VCC, Fan1-4 */
+	__u32 curr[4];		/* Fan1-4 */
+	__u32 power_cycles;
+	__u16 firmware_version;
+	__u16 reserved;
+};
+
+/*
+ * QUADRO_IOC_GET_HISTORY copies up to count samples newer than since_seq, oldest
+ * first, to the array at samples and sets count to the number copied. Samples that
+ * already left the history are skipped, which shows as a gap in their seq.
+ */
+struct quadro_history {
+	__u64 since_seq;	/* In */
+	__u64 samples;		/* In, pointer to struct quadro_sample[count] */
+	__u32 count;		/* In: capacity of samples, out: samples copied */
+	__u32 reserved;
+};
+
+/*
+ * QUADRO_IOC_WAIT_NEXT blocks until a sample newer than seq is available and returns
+ * the latest one. Fails with ETIMEDOUT after timeout_ms, 0 waits without timeout.
+ */
+struct quadro_wait {
+	__u64 seq;		/* In */
+	__u32 timeout_ms;	/* In */
+	__u32 reserved;
+	struct quadro_sample sample; /* Out */
+};
+
+/*
+ * Channels of the read() stream, in the order of struct quadro_sample. A reader selects
+ * them with QUADRO_IOC_SET_MASK, by default it gets all of them.
+ */
+#define QUADRO_NUM_CHANNELS		22
+#define QUADRO_CHAN_TEMP(n)		(1U << (n))		/* 0-3 */
+#define QUADRO_CHAN_FAN(n)		(1U << (4 + (n)))	/* 0-4, 0 is flow */
+#define QUADRO_CHAN_POWER(n)		(1U << (9 + (n)))	/* 0-3 */
+#define QUADRO_CHAN_IN(n)		(1U << (13 + (n)))	/* 0-4 */
+#define QUADRO_CHAN_CURR(n)		(1U << (18 + (n)))	/* 0-3 */
+#define QUADRO_CHAN_ALL			((1U << QUADRO_NUM_CHANNELS) - 1)
+
+/*
+ * The first read() after open and after every QUADRO_IOC_SET_MASK returns a schema
+ * describing the records that follow, without blocking. Consumers should check version
+ * and skip size bytes, newer layouts may append fields to the schema and descriptors.
+ */
+#define QUADRO_SCHEMA_MAGIC		0x48435351 /* "QSCH" */
+#define QUADRO_SCHEMA_VERSION		1
+
+struct quadro_channel_desc {
+	char name[32];		/* hwmon label */
+	char unit[8];
+	__u32 scale_den;	/* value / scale_den is in unit */
+	__u16 offset;		/* Of the __s32 value within a record */
+	__u8 bit;		/* In the channel mask */
+	__u8 reserved;
+};
+
+struct quadro_schema {
+	__u32 magic;
+	__u16 version;
+	__u16 size;		/* Including the channel descriptors */
+	__u16 record_size;
+	__u16 num_channels;
+	__u32 mask;
+	struct quadro_channel_desc channels[];
+};
+
+/*
+ * Every other read() returns whole records, one per sample and at least one, blocking
+ * unless the file is non-blocking. A record is this header followed by one __s32 for
+ * each channel in the mask, lowest bit first, with no padding in between.
+ */
+struct quadro_record {
+	__u64 seq;
+	__u64 timestamp_ns;
+	__s32 values[];
+};
+
+/*
+ * Records of the raw0..rawN relay files in debugfs, one per received status report,
+ * followed by size bytes of the report starting with its ID. The report is zero padded
+ * to a multiple of 8 bytes, so every record header is 8 byte aligned within the file and
+ * the next one starts QUADRO_RAW_RECORD_LEN(size) bytes after the current one.
+ */
+struct quadro_raw_record {
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC */
+	__u32 size;		/* Of the report, without the padding */
+	__u32 reserved;
+};
+
+#define QUADRO_RAW_RECORD_LEN(size)	(sizeof(struct quadro_raw_record) + (((size) + 7) & ~7))
+
+#define QUADRO_IOC_MAGIC		'Q'
+#define QUADRO_IOC_GET_SNAPSHOT		_IOR(QUADRO_IOC_MAGIC, 0x01, struct quadro_sample)
+#define QUADRO_IOC_GET_HISTORY		_IOWR(QUADRO_IOC_MAGIC, 0x02, struct quadro_history)
+#define QUADRO_IOC_WAIT_NEXT		_IOWR(QUADRO_IOC_MAGIC, 0x03, struct quadro_wait)
+#define QUADRO_IOC_SET_MASK		_IOW(QUADRO_IOC_MAGIC, 0x04, __u32)
+
+#endif /* _AQUACOMPUTER_QUADRO_H */
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Measures how reading the Quadro scales with concurrent readers: every thread reads
+ * all hwmon attributes of the driver in a loop, or fetches whole samples with
+ * QUADRO_IOC_GET_SNAPSHOT, and the throughput and latency percentiles are reported.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aquacomputer-quadro.h"
+
+#define HWMON_CLASS		"/sys/class/hwmon"
+#define MAX_ATTRS		256
+
+/* Latencies are counted in 100 ns buckets, the last one holds everything slower */
+#define LATENCY_BUCKET_NS	100
+#define LATENCY_BUCKETS		20000
+
+enum mode {
+	MODE_SYSFS,
+	MODE_IOCTL,
+};
+
+static const char *const mode_names[] = {
+	[MODE_SYSFS] = "sysfs",
+	[MODE_IOCTL] = "ioctl",
+};
+
+struct thread {
+	pthread_t thread;
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t max_ns;
+	uint64_t latency[LATENCY_BUCKETS];
+};
+
+static char hwmon_dir[PATH_MAX];
+static char *attrs[MAX_ATTRS];
+static int num_attrs;
+static const char *chardev = "/dev/quadro0";
+static volatile bool stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(struct thread *t, uint64_t ns, bool ok)
+{
+	uint64_t bucket = ns / LATENCY_BUCKET_NS;
+
+	t->ops++;
+	if (!ok)
+		t->errors++;
+	if (ns > t->max_ns)
+		t->max_ns = ns;
+	t->latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+}
+
+static int find_hwmon_dir(void)
+{
+	char path[PATH_MAX], name[32];
+	struct dirent *entry;
+	int found = -1;
+	FILE *f;
+	DIR *dir;
+
+	dir = opendir(HWMON_CLASS);
+	if (!dir)
+		return -1;
+
+	while (found && (entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), HWMON_CLASS "/%s/name", entry->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		if (fgets(name, sizeof(name), f) && !strcmp(name, "quadro\n")) {
+			snprintf(hwmon_dir, sizeof(hwmon_dir), HWMON_CLASS "/%s", entry->d_name);
+			found = 0;
+		}
+
+		fclose(f);
+	}
+
+	closedir(dir);
+	return found;
+}
+
+/* Every readable attribute of the driver, skipping the binary profile and sysfs internals */
+static int collect_attrs(void)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+
+	dir = opendir(hwmon_dir);
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir)) && num_attrs < MAX_ATTRS) {
+		if (entry->d_name[0] == '.' || !strcmp(entry->d_name, "uevent") ||
+		    !strcmp(entry->d_name, "profile"))
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", hwmon_dir,
+			     entry->d_name) >= (int)sizeof(path))
+			continue;
+
+		if (stat(path, &st) || !S_ISREG(st.st_mode) || !(st.st_mode & S_IRUSR))
+			continue;
+
+		attrs[num_attrs++] = strdup(path);
+	}
+
+	closedir(dir);
+	return num_attrs ? 0 : -1;
+}
+
+static void *sysfs_thread(void *arg)
+{
+	struct thread *t = arg;
+	int fds[MAX_ATTRS];
+	uint64_t start;
+	char buf[64];
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < num_attrs; i++)
+		fds[i] = open(attrs[i], O_RDONLY);
+
+	while (!stop) {
+		for (i = 0; i < num_attrs && !stop; i++) {
+			start = now_ns();
+			ret = pread(fds[i], buf, sizeof(buf), 0);
+			record(t, now_ns() - start, ret > 0);
+		}
+	}
+
+	for (i = 0; i < num_attrs; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+	return NULL;
+}
+
+static void *ioctl_thread(void *arg)
+{
+	struct quadro_sample sample;
+	struct thread *t = arg;
+	uint64_t start;
+	int fd, ret;
+
+	fd = open(chardev, O_RDONLY);
+
+	while (!stop) {
+		start = now_ns();
+		ret = ioctl(fd, QUADRO_IOC_GET_SNAPSHOT, &sample);
+		record(t, now_ns() - start, !ret);
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	return NULL;
+}
+
+/* In microseconds */
+static double percentile(const uint64_t *latency, uint64_t total, double p)
+{
+	uint64_t target = total * p, sum = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+		sum += latency[i];
+		if (sum > target)
+			break;
+	}
+
+	return i * LATENCY_BUCKET_NS / 1000.0;
+}
+
+static int run(enum mode mode, int num_threads, int seconds)
+{
+	static uint64_t latency[LATENCY_BUCKETS];
+	uint64_t ops = 0, errors = 0, max_ns = 0, start, elapsed;
+	/* A sample carries all readings, a sysfs read only one */
+	int values = mode == MODE_IOCTL ? QUADRO_NUM_CHANNELS : 1;
+	struct thread *threads;
+	int i, j;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		return -1;
+
+	memset(latency, 0, sizeof(latency));
+	stop = false;
+	start = now_ns();
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_create(&threads[i].thread, NULL,
+			       mode == MODE_IOCTL ? ioctl_thread : sysfs_thread, &threads[i]);
+	}
+
+	sleep(seconds);
+	stop = true;
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+
+		ops += threads[i].ops;
+		errors += threads[i].errors;
+		if (threads[i].max_ns > max_ns)
+			max_ns = threads[i].max_ns;
+		for (j = 0; j < LATENCY_BUCKETS; j++)
+			latency[j] += threads[i].latency[j];
+	}
+
+	elapsed = now_ns() - start;
+	free(threads);
+
+	printf("%-6s threads %3d  reads/s %10.0f  values/s %11.0f  errors %llu\n",
+	       mode_names[mode], num_threads, ops * 1e9 / elapsed, ops * values * 1e9 / elapsed,
+	       (unsigned long long)errors);
+	printf("       latency us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+	       percentile(latency, ops, 0.5), percentile(latency, ops, 0.9),
+	       percentile(latency, ops, 0.99), percentile(latency, ops, 0.999), max_ns / 1000.0);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-d seconds] [-m sysfs|ioctl|both] [-H hwmon dir] [-D device]\n"
+		"  -t  concurrent readers (default number of CPUs)\n"
+		"  -d  duration of each run in seconds (default 5)\n"
+		"  -m  read every hwmon attribute, fetch samples from the character device,\n"
+		"      or both one after the other (default both)\n"
+		"  -H  hwmon directory (default the one named quadro)\n"
+		"  -D  character device (default /dev/quadro0)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool sysfs = true, ioctls = true;
+	int seconds = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:m:H:D:h")) != -1) {
+		switch (opt) {
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			sysfs = !strcmp(optarg, "sysfs") || !strcmp(optarg, "both");
+			ioctls = !strcmp(optarg, "ioctl") || !strcmp(optarg, "both");
+			break;
+		case 'H':
+			snprintf(hwmon_dir, sizeof(hwmon_dir), "%s", optarg);
+			break;
+		case 'D':
+			chardev = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (num_threads < 1 || seconds < 1 || (!sysfs && !ioctls)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (sysfs) {
+		if (!hwmon_dir[0] && find_hwmon_dir()) {
+			fprintf(stderr, "no hwmon device named quadro found\n");
+			return 1;
+		}
+
+		if (collect_attrs()) {
+			fprintf(stderr, "no readable attributes in %s\n", hwmon_dir);
+			return 1;
+		}
+
+		printf("%d attributes in %s\n", num_attrs, hwmon_dir);
+		run(MODE_SYSFS, num_threads, seconds);
+	}
+
+	if (ioctls) {
+		if (access(chardev, R_OK)) {
+			fprintf(stderr, "%s: %s\n", chardev, strerror(errno));
+			return 1;
+		}
+
+		run(MODE_IOCTL, num_threads, seconds);
+	}
+
+	return 0;
+}
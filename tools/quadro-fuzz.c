@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * libFuzzer target for the status report decoder the driver runs on every report. Inputs
+ * are reports of any size and content, as the device or a uhid device could send them.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "aquacomputer-quadro-decoder.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct quadro_status status;
+
+	/* libFuzzer passes exactly size bytes, so any read past them trips ASan */
+	if (quadro_parse_status(&status, data, size))
+		return 0;
+
+	/* Only complete status reports may be decoded */
+	if (size < QUADRO_STATUS_DECODED_SIZE || data[0] != QUADRO_STATUS_REPORT_ID)
+		abort();
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Decodes status reports captured from the raw0..rawN relay files of the driver (module
+ * parameter raw_relay=1) with the same decoder the driver uses, and prints one CSV line
+ * per report. Files are decoded one after the other, each holds the reports that arrived
+ * on one CPU, so sort by the timestamp to merge them.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aquacomputer-quadro.h"
+#include "aquacomputer-quadro-decoder.h"
+
+/* Larger than any HID report, anything above means the capture is corrupt */
+#define MAX_REPORT_SIZE		4096
+
+static void print_header(void)
+{
+	printf("timestamp_ns,serial,firmware,power_cycles,"
+	       "temp1,temp2,temp3,temp4,flow,fan1,fan2,fan3,fan4,"
+	       "power1,power2,power3,power4,in0,in1,in2,in3,in4,"
+	       "curr1,curr2,curr3,curr4,duty1,duty2,duty3,duty4\n");
+}
+
+/* In the units of hwmon */
+static void print_status(uint64_t timestamp, const struct quadro_status *status)
+{
+	int i;
+
+	printf("%" PRIu64 ",%05u-%05u,%u,%u", timestamp, status->serial_number[0],
+	       status->serial_number[1], status->firmware_version, status->power_cycles);
+
+	for (i = 0; i < 4; i++)
+		printf(",%d", status->temp[i]);
+	for (i = 0; i < 5; i++)
+		printf(",%u", status->speed[i]);
+	for (i = 0; i < 4; i++)
+		printf(",%u", status->power[i]);
+	for (i = 0; i < 5; i++)
+		printf(",%u", status->voltage[i]);
+	for (i = 0; i < 4; i++)
+		printf(",%u", status->curr[i]);
+	for (i = 0; i < 4; i++)
+		printf(",%u", status->duty[i]);
+
+	printf("\n");
+}
+
+static int decode_file(const char *name, FILE *f, unsigned long *rejected)
+{
+	static uint8_t report[MAX_REPORT_SIZE];
+	struct quadro_raw_record record;
+	struct quadro_status status;
+	size_t len;
+	int ret;
+
+	while (fread(&record, sizeof(record), 1, f) == 1) {
+		if (record.size > MAX_REPORT_SIZE) {
+			fprintf(stderr, "%s: record of %u bytes, the capture is corrupt\n", name,
+				record.size);
+			return -1;
+		}
+
+		/* The report is followed by its padding */
+		len = QUADRO_RAW_RECORD_LEN(record.size) - sizeof(record);
+		if (fread(report, 1, len, f) != len) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			return -1;
+		}
+
+		ret = quadro_parse_status(&status, report, record.size);
+		if (ret) {
+			fprintf(stderr, "%s: report at %" PRIu64 " rejected: %s\n", name,
+				(uint64_t)record.timestamp_ns, strerror(-ret));
+			(*rejected)++;
+			continue;
+		}
+
+		print_status(record.timestamp_ns, &status);
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long rejected = 0;
+	int i, ret = 0;
+	FILE *f;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE... (- for stdin)\n", argv[0]);
+		return 1;
+	}
+
+	print_header();
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-")) {
+			ret |= decode_file("stdin", stdin, &rejected);
+			continue;
+		}
+
+		f = fopen(argv[i], "rb");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+			ret = -1;
+			continue;
+		}
+
+		ret |= decode_file(argv[i], f, &rejected);
+		fclose(f);
+	}
+
+	return ret || rejected ? 1 : 0;
+}
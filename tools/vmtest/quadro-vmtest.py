@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Checks the driver against a Quadro simulated through /dev/uhid: the hwmon inputs must
+# show the readings of the injected reports, truncated reports must be dropped, and the
+# inputs must go stale two seconds after the last report. Runs as root in a throwaway VM,
+# see make vmtest, and exits non-zero on the first mismatch.
+#
+# Usage: quadro-vmtest.py [aquacomputer-quadro.ko]
+
+import errno
+import glob
+import os
+import struct
+import subprocess
+import sys
+import time
+
+from hidtools.uhid import UHIDDevice
+
+# Vendor collection with input report 1 (status), feature reports 2 and 3 (control) and
+# output report 4 (software sensors), all with 8 bit fields
+RDESC = [
+    0x06, 0x00, 0xff,        # Usage Page (Vendor Defined 0xff00)
+    0x09, 0x01,              # Usage (1)
+    0xa1, 0x01,              # Collection (Application)
+    0x85, 0x01,              #   Report ID (1)
+    0x15, 0x00,              #   Logical Minimum (0)
+    0x26, 0xff, 0x00,        #   Logical Maximum (255)
+    0x75, 0x08,              #   Report Size (8)
+    0x96, 0xa0, 0x00,        #   Report Count (160)
+    0x09, 0x01,              #   Usage (1)
+    0x81, 0x02,              #   Input (Data, Variable, Absolute)
+    0x85, 0x02,              #   Report ID (2)
+    0x95, 0x0a,              #   Report Count (10)
+    0x09, 0x02,              #   Usage (2)
+    0xb1, 0x02,              #   Feature (Data, Variable, Absolute)
+    0x85, 0x03,              #   Report ID (3)
+    0x96, 0xc0, 0x03,        #   Report Count (960)
+    0x09, 0x03,              #   Usage (3)
+    0xb1, 0x02,              #   Feature (Data, Variable, Absolute)
+    0x85, 0x04,              #   Report ID (4)
+    0x95, 0x20,              #   Report Count (32)
+    0x09, 0x04,              #   Usage (4)
+    0x91, 0x02,              #   Output (Data, Variable, Absolute)
+    0xc0,                    # End Collection
+]
+
+REPORT_SIZE = 161
+
+# Offsets from aquacomputer-quadro-decoder.h
+POWER_CYCLES = 24
+TEMPS = (52, 54, 56, 58)
+VOLTAGE = 108
+FLOW_SPEED = 110
+FAN_BLOCKS = (112, 125, 138, 151)  # duty, voltage, current, power, speed
+
+STALE_TIMEOUT = 2.0
+
+
+class Readings:
+    """Raw values of a status report, in the device's units"""
+
+    def __init__(self, base):
+        self.temps = [2500 + base, 3000 + base, 3500 + base, 4000 + base]  # Centidegrees
+        self.flow = 1500 + base * 10  # dl/h
+        self.vcc = 1210 + base  # Centivolts
+        # duty (centipercent), voltage (centivolts), current (mA), power (cW), speed (RPM)
+        self.fans = [(2000 * (i + 1), 1200 + i, 10 + i + base, 140 + i + base, 1000 + 100 * i + base)
+                     for i in range(4)]
+
+    def report(self):
+        data = bytearray(REPORT_SIZE)
+        data[0] = 0x01
+        struct.pack_into(">I", data, POWER_CYCLES, 7)
+        for offset, temp in zip(TEMPS, self.temps):
+            struct.pack_into(">H", data, offset, temp)
+        struct.pack_into(">HH", data, VOLTAGE, self.vcc, self.flow)
+        for offset, fan in zip(FAN_BLOCKS, self.fans):
+            struct.pack_into(">HHHHH", data, offset, *fan)
+        return data
+
+    def expected(self):
+        """hwmon attribute to value in hwmon units"""
+        values = {f"temp{i + 1}_input": t * 10 for i, t in enumerate(self.temps)}
+        values["fan1_input"] = self.flow // 10
+        values["in0_input"] = self.vcc * 10
+        for i, (duty, voltage, current, power, speed) in enumerate(self.fans):
+            values[f"fan{i + 2}_input"] = speed
+            values[f"in{i + 1}_input"] = voltage * 10
+            values[f"curr{i + 1}_input"] = current
+            values[f"power{i + 1}_input"] = power * 10000
+        return values
+
+
+def fail(msg):
+    print(f"FAIL: {msg}")
+    sys.exit(1)
+
+
+def read_attr(hwmon, attr):
+    with open(os.path.join(hwmon, attr)) as f:
+        return int(f.read())
+
+
+def find_hwmon():
+    for path in glob.glob("/sys/class/hwmon/hwmon*"):
+        with open(os.path.join(path, "name")) as f:
+            if f.read().strip() == "quadro":
+                return path
+    return None
+
+
+def pump(dev, seconds, report=None):
+    """Answers the device's requests for a while, sending report every 100 ms if given"""
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        if report is not None:
+            dev.call_input_event(report)
+        dev.dispatch(100)
+
+
+def check_readings(dev, hwmon, readings, what):
+    expected = readings.expected()
+
+    # Decoding is deferred to a work item, give it a few reports to catch up
+    for _ in range(30):
+        pump(dev, 0.1, readings.report())
+        if read_attr(hwmon, "temp1_input") == expected["temp1_input"]:
+            break
+
+    for attr, value in sorted(expected.items()):
+        got = read_attr(hwmon, attr)
+        if got != value:
+            fail(f"{what}: {attr} is {got}, expected {value}")
+
+    print(f"ok: {what}")
+
+
+def check_stale(dev, hwmon):
+    pump(dev, STALE_TIMEOUT + 0.5)
+
+    for attr in Readings(0).expected():
+        try:
+            got = read_attr(hwmon, attr)
+        except OSError as e:
+            if e.errno != errno.ENODATA:
+                fail(f"stale: {attr} failed with {e}, expected ENODATA")
+            continue
+        fail(f"stale: {attr} read {got} {STALE_TIMEOUT} s after the last report")
+
+    events = glob.glob("/sys/kernel/debug/aquacomputer-quadro-*/events")
+    if events:
+        with open(events[0]) as f:
+            if " stale " not in f.read():
+                fail("stale: not logged in the events file")
+
+    print("ok: inputs go stale without reports")
+
+
+def main():
+    if len(sys.argv) > 1:
+        # Dependencies when they are modular, insmod doesn't resolve them. Kernels with
+        # them built in or without IIO don't have these modules, which is fine.
+        subprocess.run(["modprobe", "-a", "crc16", "industrialio", "kfifo_buf"], check=False)
+        subprocess.run(["insmod", sys.argv[1]], check=True)
+    if not os.path.exists("/dev/uhid"):
+        subprocess.run(["modprobe", "uhid"], check=True)
+
+    dev = UHIDDevice()
+    dev.name = "Simulated Quadro"
+    dev.info = (0x03, 0x0c70, 0xf00d)  # BUS_USB
+    dev.rdesc = RDESC
+    dev.create_kernel_device()
+
+    hwmon = None
+    for _ in range(50):
+        pump(dev, 0.1)
+        hwmon = find_hwmon()
+        if hwmon:
+            break
+    if not hwmon:
+        fail("no hwmon device named quadro appeared")
+
+    check_readings(dev, hwmon, Readings(0), "first report")
+    check_readings(dev, hwmon, Readings(7), "changed report")
+
+    # A report shorter than the descriptor declares is dropped, the readings stay
+    truncated = Readings(20).report()[:REPORT_SIZE - 1]
+    pump(dev, 0.5, truncated)
+    got = read_attr(hwmon, "temp1_input")
+    if got != Readings(7).expected()["temp1_input"]:
+        fail(f"truncated report: temp1_input changed to {got}")
+    print("ok: truncated reports are dropped")
+
+    check_stale(dev, hwmon)
+    check_readings(dev, hwmon, Readings(3), "recovery after going stale")
+
+    dev.destroy()
+    time.sleep(0.5)
+    if find_hwmon():
+        fail("hwmon device still present after the device was destroyed")
+    print("ok: device removed")
+
+    if len(sys.argv) > 1:
+        subprocess.run(["rmmod", "aquacomputer-quadro"], check=True)
+
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()